@@ -8,6 +8,7 @@
 
 #include <iostream>
 #include <chrono>
+#include <string_view>
 
 #include "coring/async_logger.hpp"
 #include "coring/detail/debug.hpp"
@@ -44,7 +45,7 @@ struct EchoServer {
   task<> echo_loop(tcp::connection conn) {
     try {
       while (true) {
-        auto read_buffer = co_await pool.read(conn.fd(), GID);
+        auto read_buffer = co_await pool.read(conn.io_fd(), GID, 0, conn.io_flags());
         LOG_INFO("read,bid: {} sz: {}", read_buffer->buffer_id(), read_buffer->readable());
         co_await write_all(&conn, read_buffer.get());
         LOG_INFO("written");
@@ -55,7 +56,8 @@ struct EchoServer {
   }
 
   task<> event_loop() {
-    co_await pool.provide_group_contiguous(buf, MAX_MESSAGE_LEN, BUFFERS_COUNT, GID);
+    // buffers are recycled by a tail bump of the buffer ring, a.k.a. no provide_buffers sqe per message.
+    co_await pool.provide_group_ring(buf, MAX_MESSAGE_LEN, BUFFERS_COUNT, GID);
     try {
       while (true) {
         LOG_TRACE("co await accept");
@@ -67,8 +69,28 @@ struct EchoServer {
     catch_it;
   }
 
-  void run() {
+  /// print counters of the completion side, to compare the reaping modes.
+  task<> stats_loop() {
+    using namespace std::chrono_literals;
+    uint64_t last_cqes = 0;
+    while (true) {
+      co_await timeout(5s);
+      auto &st = context.reap_stats();
+      std::cout << "cqes/s: " << (st.cqes - last_cqes) / 5 << ", cqes per round: "
+                << (st.rounds == 0 ? 0 : st.cqes / st.rounds) << ", overflow backlogged: " << st.overflow_backlogged
+                << ", dropped: " << st.overflow_dropped << std::endl;
+      last_cqes = st.cqes;
+    }
+  }
+
+  void run(bool batched, bool stats, bool fixed) {
+    context.set_batched_reaping(batched);
+    // accepted sockets go into the fixed file table, no fget/fput per recv/send.
+    context.fixed_files().set_auto_install(fixed);
     context.schedule(event_loop());
+    if (stats) {
+      context.schedule(stats_loop());
+    }
     context.run();
   }
 
@@ -80,11 +102,28 @@ struct EchoServer {
 int main(int argc, char *argv[]) {
   __u16 port;
   bool logger_on = false;
-  if (argc > 2) logger_on = true;
+  bool batched = false;
+  bool stats = false;
+  bool fixed = false;
+  for (int i = 2; i < argc; i++) {
+    if (std::string_view(argv[i]) == "--batched") {
+      batched = true;
+    } else if (std::string_view(argv[i]) == "--stats") {
+      stats = true;
+    } else if (std::string_view(argv[i]) == "--fixed") {
+      fixed = true;
+    } else {
+      logger_on = true;
+    }
+  }
   if (argc > 1) {
     port = static_cast<uint16_t>(::atoi(argv[1]));
   } else {
-    std::cout << "Please give a port number: ./echo_server [port: u16] [logger on: any]" << std::endl;
+    std::cout << "Please give a port number: ./echo_server [port: u16] [logger on: any] [--batched] [--stats] [--fixed]"
+              << std::endl
+              << "--batched: reap cqes in batch (advance the CQ head before resuming), --stats: print cq counters"
+              << std::endl
+              << "--fixed: use registered (fixed) files for connections" << std::endl;
     exit(0);
   }
   EchoServer server{port};
@@ -92,10 +131,10 @@ int main(int argc, char *argv[]) {
     async_logger logger{"echo_server"};
     logger.start();
     set_log_level(INFO);  // no logging output by default
-    server.run();
+    server.run(batched, stats, fixed);
   } else {
     set_log_level(LOG_LEVEL_CNT);
-    server.run();
+    server.run(batched, stats, fixed);
   }
   return 0;
 }
\ No newline at end of file
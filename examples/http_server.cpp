@@ -4,14 +4,15 @@
 #include "coring/io_context.hpp"
 #include "coring/async_logger.hpp"
 #include "coring/acceptor.hpp"
-#include "coring/buffer_pool.hpp"
 #include "coring/file.hpp"
 #include "http1/http_context.hpp"
 #include "http1/http_request.hpp"
 #include "http1/http_response.hpp"
 #include "coring/socket_writer.hpp"
 #include "coring/socket_reader.hpp"
+#include "coring/buffer_chain.hpp"
 
+#include <list>
 #include <fcntl.h>
 #include <sys/stat.h>
 
@@ -22,13 +23,11 @@
 
 #define MAX_CONNECTIONS 4096
 #define BUFFER_BLOCK_SIZE 2048
-#define BUFFERS_COUNT MAX_CONNECTIONS
-
-char buf[BUFFERS_COUNT * BUFFER_BLOCK_SIZE];
+// body blocks per sendmsg when the body can't be spliced.
+#define CHAIN_BLOCKS 4
 
 using namespace coring;
 using namespace coring::http;
-buffer_pool::id_t GID("MD");
 
 std::stop_source *global_source;
 
@@ -39,12 +38,43 @@ task<> send_header(tcp::connection *conn, HttpResponse *res) {
   co_await write_all(conn, &header_buf);
 }
 
+/// Without IORING_OP_SPLICE the body goes through the user space: the header and the first CHAIN_BLOCKS blocks
+/// go out by a single sendmsg, then CHAIN_BLOCKS blocks per sendmsg, instead of one send per buffer.
+task<> send_file_gather(tcp::connection *conn, HttpResponse *res, file_t *file, off_t total_size) {
+  buffer header_buf(512);
+  res->appendToBuffer(&header_buf);
+  std::list<buffer> blocks;
+  for (int i = 0; i < CHAIN_BLOCKS; i++) {
+    blocks.emplace_back(BUFFER_BLOCK_SIZE);
+  }
+  buffer_chain chain;
+  chain.append(&header_buf);
+  off_t sent_bytes = 0;
+  while (sent_bytes < total_size) {
+    for (auto &b : blocks) {
+      if (sent_bytes == total_size) {
+        break;
+      }
+      b.clear();
+      int n = co_await file->read(b.back(), b.writable(), sent_bytes);
+      if (n <= 0) {
+        throw coring::eof_error{};
+      }
+      b.has_written(n);
+      sent_bytes += n;
+      chain.append(&b);
+    }
+    co_await write_all(conn, &chain);
+    chain.clear();
+  }
+}
+
 inline task<> send_bad_request(tcp::connection *conn, HttpResponse *res) {
   res->setStatusCode(HttpResponse::k400BadRequest);
   return send_header(conn, res);
 }
 
-task<> send_file(tcp::connection *conn, buffer_pool *pool, HttpResponse *res, const string &path) {
+task<> serve_file(tcp::connection *conn, HttpResponse *res, const string &path) {
   if (path == "public/bench") {
     res->setStatusCode(HttpResponse::k404NotFound);
     co_await send_header(conn, res);
@@ -64,23 +94,24 @@ task<> send_file(tcp::connection *conn, buffer_pool *pool, HttpResponse *res, co
       res->setContentTypeByPath(path);
       res->setContentLength(total_size);
     }
-    co_await send_header(conn, res);
     if (total_size == 0) {
+      co_await send_header(conn, res);
       co_return;
     }
-    long sent_bytes = 0;
-    while (sent_bytes < total_size) {
-      auto bf = co_await pool->read(file, GID, sent_bytes);
-      sent_bytes += static_cast<decltype(sent_bytes)>(bf->readable());
-      co_await write_all(conn, bf.get());
+    if (!coro::get_io_context_ref().opcode_supported(IORING_OP_SPLICE)) {
+      co_await send_file_gather(conn, res, &file, total_size);
+      co_return;
     }
+    co_await send_header(conn, res);
+    // the body goes file -> pipe -> socket by splice, never copied to the user space.
+    co_await send_file(conn, &file, 0, static_cast<size_t>(total_size));
     LOG_TRACE("one file is responses: {} bytes", total_size);
   } catch (coring::bad_file &e) {
     res->setStatusCode(HttpResponse::k404NotFound);
   }
 }
 
-task<> do_http(tcp::connection conn, buffer_pool *pool) {
+task<> do_http(tcp::connection conn) {
   // LOG_TRACE("new client");
   http::HttpContext ctx;
   auto read_buffer = buffer(BUFFER_BLOCK_SIZE);
@@ -97,7 +128,7 @@ task<> do_http(tcp::connection conn, buffer_pool *pool) {
       } else if (ctx.gotAll()) {
         close = ctx.request().keepalive();
         res.setCloseConnection(close);
-        co_await send_file(&conn, pool, &res, ctx.request().path());
+        co_await serve_file(&conn, &res, ctx.request().path());
       }
       ctx.reset();
     }
@@ -106,13 +137,12 @@ task<> do_http(tcp::connection conn, buffer_pool *pool) {
   }
 }
 
-task<> server(tcp::acceptor *actor, buffer_pool *pool, std::stop_token token) {
+task<> server(tcp::acceptor *actor, std::stop_token token) {
   co_await actor->better_enable();
-  co_await pool->provide_group_contiguous(buf, BUFFER_BLOCK_SIZE, BUFFERS_COUNT, GID);
   try {
     while (!token.stop_requested()) {
       auto conn = co_await actor->accept();
-      co_spawn(do_http(std::move(conn), pool));
+      co_spawn(do_http(std::move(conn)));
     }
   } catch (std::exception &e) {
     LOG_INFO("something happened, server done, msg: {}", e.what());
@@ -133,7 +163,7 @@ int main(int argc, char *argv[]) {
   // setup signals
   auto sigint = signal_set::sigint_for_context();
   // setup single thread io_context
-  // io_context context(QUEUE_DEPTH, IORING_SETUP_SQPOLL);
+  // auto context = io_context::with_sqpoll(QUEUE_DEPTH, /* the SQ thread on cpu */ 1);
   io_context context(QUEUE_DEPTH);
   context.register_signals(sigint, sigint_handler);
   // chores
@@ -144,14 +174,17 @@ int main(int argc, char *argv[]) {
   logger.enable();
   coring::set_log_level(INFO);
   LOG_INFO("HTTP/1.0 Webserver is listening on port: {}", DEFAULT_SERVER_PORT);
-  // init memory management
-  buffer_pool pool{};
   // setup sockets
   tcp::acceptor acceptor(ANY_IN, port);
   // make sure we have collected all logs
   // prepare to run the server
-  context.schedule(server(&acceptor, &pool, src.get_token()));
+  context.schedule(server(&acceptor, src.get_token()));
   // blocking until exit
   context.run();
+  // cancel the idle connections, let the responses in flight out.
+  using namespace std::chrono_literals;
+  if (!context.shutdown(3s)) {
+    LOG_INFO("some connections are still alive after the shutdown deadline");
+  }
   return 0;
 }
\ No newline at end of file
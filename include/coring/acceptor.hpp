@@ -7,6 +7,7 @@
 #include "endpoint.hpp"
 #include "socket.hpp"
 #include "task.hpp"
+#include "async_generator.hpp"
 #include "io_context.hpp"
 #include "tcp_connection.hpp"
 
@@ -94,11 +95,13 @@ class acceptor : noncopyable {
 
   template <typename CONNECTION_TYPE = tcp::connection>
   requires(std::is_same_v<tcp::connection, CONNECTION_TYPE> ||
-           std::is_same_v<tcp::peer_connection, CONNECTION_TYPE>) async_task<CONNECTION_TYPE> accept() {
+           std::is_same_v<tcp::peer_connection, CONNECTION_TYPE>) async_task<CONNECTION_TYPE> accept(std::stop_token
+                                                                                                        stop = {}) {
     auto &ctx = coro::get_io_context_ref();
     net::endpoint peer_addr{};
     auto addr_len = net::endpoint::len;
-    auto connfd = co_await ctx.accept(listenfd_, peer_addr.as_sockaddr(), &addr_len);
+    // a stop requested while waiting for a connection throws std::system_error(ECANCELED).
+    auto connfd = co_await with_stop(ctx.accept(listenfd_, peer_addr.as_sockaddr(), &addr_len), std::move(stop));
     if (connfd == -ENFILE) {
       co_await ctx.close(backupfd_);
       connfd = co_await ctx.accept(listenfd_, peer_addr.as_sockaddr(), &addr_len);
@@ -110,7 +113,73 @@ class acceptor : noncopyable {
     if (connfd < 0 && connfd != -EINTR) {
       throw std::system_error(std::error_code{-connfd, std::system_category()});
     }
-    co_return CONNECTION_TYPE(socket{connfd}, peer_addr);
+    CONNECTION_TYPE conn(socket{connfd}, peer_addr);
+    detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+    co_return conn;
+  }
+
+  /// Accept connections with a single multishot accept request instead of a sqe per connection.
+  /// It's re-armed automatically when the kernel ends it (e.g. fd exhausted), and the ENFILE
+  /// backup-fd trick works as accept() does (call better_enable() first).
+  /// The request is cancelled when the generator is destroyed, connections accepted but not consumed
+  /// by then are closed.
+  /// \param direct yield fixed file slot indexes instead of fds, allocated by the kernel from the direct range of
+  /// io_context::fixed_files() (registered here if not yet), use IOSQE_FIXED_FILE for operations on them.
+  /// \return a async generator of fds or slot indexes, ends if the request is cancelled by others.
+  async_generator<int> accept_fd_stream(bool direct = false) {
+    auto &ctx = coro::get_io_context_ref();
+    if (direct && !ctx.fixed_files().ensure_registered()) {
+      throw std::system_error(std::error_code{ENXIO, std::system_category()}, "fixed file table");
+    }
+    detail::multishot_token::drop_func_t drop = direct ? &drop_direct : &drop_fd;
+    auto token = new detail::multishot_token{drop, &ctx};
+    detail::on_scope_exit cancel_at_exit{[&ctx, token] { ctx.cancel_multishot(token); }};
+    while (true) {
+      if (token->drained()) {
+        ctx.multishot_accept(listenfd_, token, direct);
+      }
+      auto [connfd, flags] = co_await token->next();
+      if (connfd >= 0) {
+        co_yield connfd;
+      } else if (connfd == -ENFILE) {
+        co_await reject_one(ctx);
+      } else if (connfd == -ECANCELED) {
+        co_return;
+      } else if (connfd != -EINTR && connfd != -EAGAIN) {
+        throw std::system_error(std::error_code{-connfd, std::system_category()});
+      }
+    }
+  }
+
+  /// A async generator of connections backed by accept_fd_stream, move the connection out of the iterator.
+  /// They are installed into the fixed file table if `fixed` is set or the context has auto install on
+  /// (io_context::fixed_files().set_auto_install(true)), as accept() does, io ops on them go with IOSQE_FIXED_FILE.
+  /// NOTICE: direct descriptors (a slot without a fd) are only yielded by accept_fd_stream(true), a connection
+  /// keeps its fd for the sync socket calls (setsockopt, getpeername...), the fixed slot is for the io.
+  /// <p>Usage:</p>
+  /// @code
+  ///  auto conns = acceptor.accept_stream(true);
+  ///  for (auto it = co_await conns.begin(); it != conns.end(); co_await ++it) {
+  ///    co_spawn(echo(std::move(*it)));
+  ///  }
+  /// @endcode
+  /// \param fixed install every connection into the fixed file table (if it has a free slot).
+  template <typename CONNECTION_TYPE = tcp::connection>
+  requires(std::is_same_v<tcp::connection, CONNECTION_TYPE> ||
+           std::is_same_v<tcp::peer_connection, CONNECTION_TYPE>) async_generator<CONNECTION_TYPE> accept_stream(
+      bool fixed = false) {
+    auto fds = accept_fd_stream();
+    auto it = co_await fds.begin();
+    while (it != fds.end()) {
+      CONNECTION_TYPE conn{socket{*it}};
+      if (fixed) {
+        conn.use_fixed_file();
+      } else {
+        detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+      }
+      co_yield conn;
+      co_await ++it;
+    }
   }
 
   void stop() {}
@@ -118,10 +187,31 @@ class acceptor : noncopyable {
   ~acceptor() { ::close(listenfd_); }
 
  private:
+  /// fd exhausted, free the backup fd to accept one and close it at once, so the peer
+  /// would not hang in the backlog forever.
+  task<> reject_one(io_context &ctx) {
+    if (backupfd_ >= 0) {
+      co_await ctx.close(backupfd_);
+      backupfd_ = -1;
+    }
+    auto connfd = co_await ctx.accept(listenfd_, nullptr, nullptr);
+    if (connfd >= 0) {
+      co_await ctx.close(connfd);
+    }
+    auto fd = co_await ctx.openat(AT_FDCWD, "/dev/null", 0, O_RDONLY | O_CLOEXEC);
+    backupfd_ = fd >= 0 ? fd : -1;
+  }
+
+  static void drop_fd(void *, int fd, __u32) { ::close(fd); }
+
+  static void drop_direct(void *ctx, int slot, __u32) {
+    static_cast<io_context *>(ctx)->fixed_files().release_direct(slot);
+  }
+
   net::endpoint local_addr_;
   int backlog_;
   int listenfd_;
-  int backupfd_;
+  int backupfd_{-1};
 };
 }  // namespace coring::tcp
 
@@ -58,6 +58,13 @@ class async_scope {
     }(this, std::forward<AWAITABLE>(awaitable), std::forward<Functor>(f));
   }
 
+  /// How many spawned works are not finished yet, it's only a snapshot.
+  [[nodiscard]] size_t pending() const noexcept {
+    // one extra count is held until join() is called.
+    auto cnt = m_count.load(std::memory_order_relaxed);
+    return cnt > 0 ? cnt - 1 : 0;
+  }
+
   [[nodiscard]] auto join() noexcept {
     class awaiter {
       async_scope *m_scope;
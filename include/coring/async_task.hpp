@@ -36,9 +36,10 @@
 #include "broken_promise.hpp"
 #include "coring/detail/async/remove_rvalue_reference.hpp"
 #include "coring/awaitable_traits.hpp"
+#include "coring/detail/async/frame_allocator.hpp"
 
 namespace coring {
-template <typename T>
+template <typename T = void, typename FrameTag = default_frames>
 class async_task;
 
 namespace detail {
@@ -74,8 +75,8 @@ class async_task_promise_base {
   std::coroutine_handle<> who_await_me_;
 };
 
-template <typename T>
-class async_task_promise final : public async_task_promise_base {
+template <typename T, typename FrameTag>
+class async_task_promise final : public async_task_promise_base, public frame_allocation<FrameTag> {
  public:
   async_task_promise() noexcept {};
 
@@ -92,7 +93,7 @@ class async_task_promise final : public async_task_promise_base {
     }
   }
 
-  async_task<T> get_return_object() noexcept;
+  async_task<T, FrameTag> get_return_object() noexcept;
 
   void unhandled_exception() noexcept {
     ::new (static_cast<void *>(std::addressof(m_exception))) std::exception_ptr(std::current_exception());
@@ -143,12 +144,12 @@ class async_task_promise final : public async_task_promise_base {
   };
 };
 
-template <>
-class async_task_promise<void> : public async_task_promise_base {
+template <typename FrameTag>
+class async_task_promise<void, FrameTag> : public async_task_promise_base, public frame_allocation<FrameTag> {
  public:
   async_task_promise() noexcept = default;
 
-  async_task<void> get_return_object() noexcept;
+  async_task<void, FrameTag> get_return_object() noexcept;
 
   void return_void() noexcept {}
 
@@ -164,12 +165,12 @@ class async_task_promise<void> : public async_task_promise_base {
   std::exception_ptr m_exception;
 };
 
-template <typename T>
-class async_task_promise<T &> : public async_task_promise_base {
+template <typename T, typename FrameTag>
+class async_task_promise<T &, FrameTag> : public async_task_promise_base, public frame_allocation<FrameTag> {
  public:
   async_task_promise() noexcept = default;
 
-  async_task<T &> get_return_object() noexcept;
+  async_task<T &, FrameTag> get_return_object() noexcept;
 
   void unhandled_exception() noexcept { m_exception = std::current_exception(); }
 
@@ -202,10 +203,11 @@ class async_task_promise<T &> : public async_task_promise_base {
 /// simply captures any passed parameters and execute the task
 /// until it reach the first co_await point (that blocks the coroutine), then it
 /// returns execution to the caller.
-template <typename T = void>
+/// async_task<T, pooled_frames> recycles its frame like task<T, pooled_frames>.
+template <typename T, typename FrameTag>
 class async_task {
  public:
-  using promise_type = detail::async_task_promise<T>;
+  using promise_type = detail::async_task_promise<T, FrameTag>;
 
   using value_type = T;
 
@@ -316,18 +318,19 @@ class async_task {
 };
 
 namespace detail {
-template <typename T>
-async_task<T> async_task_promise<T>::get_return_object() noexcept {
-  return async_task<T>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
+template <typename T, typename FrameTag>
+async_task<T, FrameTag> async_task_promise<T, FrameTag>::get_return_object() noexcept {
+  return async_task<T, FrameTag>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
 }
 
-inline async_task<void> async_task_promise<void>::get_return_object() noexcept {
-  return async_task<void>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
+template <typename FrameTag>
+async_task<void, FrameTag> async_task_promise<void, FrameTag>::get_return_object() noexcept {
+  return async_task<void, FrameTag>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
 }
 
-template <typename T>
-async_task<T &> async_task_promise<T &>::get_return_object() noexcept {
-  return async_task<T &>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
+template <typename T, typename FrameTag>
+async_task<T &, FrameTag> async_task_promise<T &, FrameTag>::get_return_object() noexcept {
+  return async_task<T &, FrameTag>{std::coroutine_handle<async_task_promise>::from_promise(*this)};
 }
 }  // namespace detail
 template <typename Awaitable>
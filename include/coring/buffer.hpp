@@ -4,8 +4,11 @@
 #include "coring/coring_config.hpp"
 #include "coring/detail/noncopyable.hpp"
 #include "coring/detail/debug.hpp"
+#include "coring/detail/search.hpp"
+#include "coring/detail/buffer_storage.hpp"
 #include "coring/endian.hpp"
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <cassert>
 #include <cstring>
@@ -117,55 +120,34 @@ class buffer_base : noncopyable {
   }
 
   /// As named
-  /// \return the place of first cr (\r)
-  [[nodiscard]] const char *find(char ch) const {
-    const char *crlf = memchr(front(), ch, readable());
-    return crlf == back() ? nullptr : crlf;
-  }
+  /// \return the place of first ch, nullptr if none
+  [[nodiscard]] const char *find(char ch) const { return search::find_byte(front(), back(), ch); }
 
   /// As named
-  /// \return the place of first cr (\r)
-  [[nodiscard]] const char *find_crlf() const {
-    const char *crlf = std::search(front(), back(), kCRLF, kCRLF + 2);
-    return crlf == back() ? nullptr : crlf;
-  }
+  /// \return the place of first cr (\r), nullptr if none
+  [[nodiscard]] const char *find_crlf() const { return search::find_crlf(front(), back()); }
 
   /// as named
   /// \param start
-  /// \return the place of first cr (\r)
-  [[nodiscard]] const char *find_crlf(const char *start) const {
-    const char *crlf = std::search(start, back(), kCRLF, kCRLF + 2);
-    return crlf == back() ? nullptr : crlf;
-  }
+  /// \return the place of first cr (\r), nullptr if none
+  [[nodiscard]] const char *find_crlf(const char *start) const { return search::find_crlf(start, back()); }
 
   /// For http header separator (RFC 2616 s4.1)
-  /// \return the place of first cr (\r)
-  [[nodiscard]] const char *find_2crlf() const {
-    const char *crlf = std::search(front(), back(), kCRLF, kCRLF + 4);
-    return crlf == back() ? nullptr : crlf;
-  }
+  /// \return the place of first cr (\r), nullptr if none
+  [[nodiscard]] const char *find_2crlf() const { return search::find_2crlf(front(), back()); }
 
   /// For http header separator (RFC 2616 s4.1)
   /// \param start
-  /// \return the place of first cr (\r)
-  [[nodiscard]] const char *find_2crlf(const char *start) const {
-    const char *crlf = std::search(start, back(), kCRLF, kCRLF + 4);
-    return crlf == back() ? nullptr : crlf;
-  }
+  /// \return the place of first cr (\r), nullptr if none
+  [[nodiscard]] const char *find_2crlf(const char *start) const { return search::find_2crlf(start, back()); }
 
   /// find a '\n'
   /// \return the place of first lf
-  [[nodiscard]] const char *find_eol() const {
-    const void *eol = memchr(front(), '\n', readable());
-    return static_cast<const char *>(eol);
-  }
+  [[nodiscard]] const char *find_eol() const { return search::find_byte(front(), back(), '\n'); }
 
   /// find a '\n'
   /// \return the place of first lf
-  [[nodiscard]] const char *findEOL(const char *start) const {
-    const void *eol = memchr(start, '\n', back() - start);
-    return static_cast<const char *>(eol);
-  }
+  [[nodiscard]] const char *findEOL(const char *start) const { return search::find_byte(start, back(), '\n'); }
 
  protected:
   Container container_;
@@ -194,7 +176,7 @@ class fixed_buffer : public detail::buffer_base<detail::buffer_view> {
   void make_room(size_t want) {
     if (index_read_ > 0) {
       size_t now_have = readable();
-      ::memmove(container_.data() + index_read_, front(), now_have);
+      ::memmove(container_.data(), front(), now_have);
       index_read_ = 0;
       index_write_ = now_have;
       //      LDR("make room: move readable %lu", want);
@@ -249,18 +231,20 @@ class fixed_buffer : public detail::buffer_base<detail::buffer_view> {
   }
 };
 
-class flex_buffer : public detail::buffer_base<std::vector<char>> {
-  typedef detail::buffer_base<std::vector<char>> upper_buffer_t;
+/// The storage comes from the per-thread freelists (detail/buffer_storage.hpp) and is not zero-filled, neither
+/// at construction nor when make_room grows it, a.k.a. a buffer per request doesn't cost a malloc and a memset.
+class flex_buffer : public detail::buffer_base<detail::buffer_storage> {
+  typedef detail::buffer_base<detail::buffer_storage> upper_buffer_t;
 
  public:
   typedef char value_type;
-  explicit flex_buffer(int init_size = BUFFER_DEFAULT_SIZE) : upper_buffer_t{std::vector<char>(init_size)} {}
+  explicit flex_buffer(int init_size = BUFFER_DEFAULT_SIZE) : upper_buffer_t{detail::buffer_storage(init_size)} {}
 
   void make_room(size_t want) {
     //    LDR("make room: %lu", want);
     if (index_read_ > 0) {
       size_t now_have = readable();
-      ::memmove(container_.data() + index_read_, front(), now_have);
+      ::memmove(container_.data(), front(), now_have);
       index_read_ = 0;
       index_write_ = now_have;
       //      LDR("make room: move readable %lu", want);
@@ -0,0 +1,84 @@
+// buffer_chain.hpp
+// Created by PanJunzhong on 2022/5/21.
+//
+// A list of readable regions (iovecs) of several buffers, so that a header and many body blocks go out by
+// a single sendmsg/writev, a.k.a. one sqe and (maybe) fewer tcp segments instead of one send per buffer.
+
+#ifndef CORING_BUFFER_CHAIN_HPP
+#define CORING_BUFFER_CHAIN_HPP
+#include <sys/uio.h>
+#include <climits>
+#include <algorithm>
+#include <vector>
+#include <string_view>
+
+namespace coring {
+/// It doesn't own the buffers nor mark them as read, keep them alive and untouched until the chain is written.
+/// Partial writes are handled by consume(), which moves the head across iovecs.
+class buffer_chain {
+ public:
+  buffer_chain() = default;
+
+  /// Append the readable part of a buffer (flex_buffer, fixed_buffer, selected_buffer...), empty ones are skipped.
+  template <typename Buffer>
+  requires requires(Buffer *b) {
+    b->front();
+    b->readable();
+  }
+  void append(Buffer *buffer) {
+    append(buffer->front(), buffer->readable());
+  }
+
+  void append(std::string_view sv) { append(sv.data(), sv.size()); }
+
+  void append(const void *data, size_t len) {
+    if (len == 0) {
+      return;
+    }
+    iovs_.push_back({const_cast<void *>(data), len});
+    readable_ += len;
+  }
+
+  /// \return bytes not written yet.
+  [[nodiscard]] size_t readable() const { return readable_; }
+
+  [[nodiscard]] bool empty() const { return readable_ == 0; }
+
+  /// \return the first iovec not (fully) written.
+  [[nodiscard]] iovec *iov() { return iovs_.data() + head_; }
+
+  /// \return how many iovecs to pass to a sendmsg/writev, at most IOV_MAX, the rest go with the next one.
+  [[nodiscard]] size_t iov_count() const { return std::min(iovs_.size() - head_, static_cast<size_t>(IOV_MAX)); }
+
+  /// n bytes are written, skip the iovecs done and shrink the partial one.
+  void consume(size_t n) {
+    readable_ -= n;
+    while (n != 0) {
+      auto &v = iovs_[head_];
+      if (n < v.iov_len) {
+        v.iov_base = static_cast<char *>(v.iov_base) + n;
+        v.iov_len -= n;
+        return;
+      }
+      n -= v.iov_len;
+      head_++;
+    }
+    if (head_ == iovs_.size()) {
+      clear();
+    }
+  }
+
+  /// Drop all regions, the iovec storage is kept for reusing.
+  void clear() {
+    iovs_.clear();
+    head_ = 0;
+    readable_ = 0;
+  }
+
+ private:
+  std::vector<iovec> iovs_{};
+  size_t head_{0};
+  size_t readable_{0};
+};
+}  // namespace coring
+#endif  // CORING_BUFFER_CHAIN_HPP
@@ -3,9 +3,15 @@
 #define CORING_BUFFER_POOL_HPP
 #include <list>
 #include <functional>
+#include <bit>
+#include <coroutine>
+#include <vector>
+#include <sys/mman.h>
 
 #ifndef NO_IO_CONTEXT
 #include "coring/io_context.hpp"
+#include "coring/detail/io/stoppable_awaiter.hpp"
+#include "coring/async_generator.hpp"
 #endif
 #include "coring/buffer.hpp"
 #include "coring/detail/io_utils.hpp"
@@ -41,6 +47,9 @@ struct hash<coring::detail::buffer_id_t> {
 };
 }  // namespace std
 namespace coring {
+namespace detail {
+class provided_buffer_group;
+}  // namespace detail
 #ifndef NO_IO_CONTEXT
 template <typename ContextService = coro>
 #else
@@ -74,8 +83,32 @@ class selected_buffer final : public fixed_buffer {
   __u16 buffer_id() { return buf_id_; }
 
  private:
+  /// Give it back to the kernel with a tail bump if it's from a buffer ring, no sqe needed.
+  /// \return false if it's from a provide_buffers group, call provide_buffers then.
+  bool recycle_to_ring() noexcept {
+#ifndef NO_IO_CONTEXT
+    if (buf_ring_ == nullptr) {
+      return false;
+    }
+    clear();
+    io_uring_buf_ring_add(buf_ring_, data(), static_cast<unsigned>(size()), buf_id_, ring_mask_, 0);
+    io_uring_buf_ring_advance(buf_ring_, 1);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /// It's back to the kernel, wake up a recv_stream starved of buffers of the group (if any).
+  inline void recycled() noexcept;
+
   detail::buffer_id_t group_id_;
   __u16 buf_id_;
+#ifndef NO_IO_CONTEXT
+  io_uring_buf_ring *buf_ring_{nullptr};
+  int ring_mask_{0};
+#endif
+  detail::provided_buffer_group *group_{nullptr};
 };
 template <typename ContextService>
 class selected_buffer_resource : noncopyable {
@@ -86,11 +119,15 @@ class selected_buffer_resource : noncopyable {
     /// FIXME: if the return value is <=0, we have problems...
     /// You may want to have a look on: P1662 Adding async RAII support to coroutines, FYI:
     /// @see https://github.com/cplusplus/papers/issues?q=RAII
-    if (val != nullptr) {
+    if (val == nullptr) {
+      return;
+    }
+    if (!val->recycle_to_ring()) {
       [[maybe_unused]] auto ret = ContextService::get_io_context_ref().provide_buffers(
           const_cast<char *>(val->data()), static_cast<int>(val->size()), 1, val->group_id_, val->buf_id_);
       val->clear();
     }
+    val->recycled();
   }
   selected_buffer *get() { return val; }
   selected_buffer *operator->() { return val; }
@@ -107,9 +144,47 @@ class provided_buffer_group {
   detail::buffer_id_t start_buf_id{};
   int nbytes_per_block{0};  // clumped at 2 GB
   std::vector<selected_buffer> blocks{};
+#ifndef NO_IO_CONTEXT
+  // only for the ring-mapped groups
+  io_uring_buf_ring *buf_ring{nullptr};
+  unsigned ring_entries{0};
+#endif
+  // recv_streams waiting for a buffer to come back (the group ran dry), one is resumed per recycled buffer.
+  std::vector<std::coroutine_handle<>> starved{};
+  // bumped per recycled buffer, a stream whose request ran dry waits only if none came back since it's armed.
+  size_t recycles{0};
+
+  /// Suspend until a buffer of the group is recycled.
+  /// \param waiting set to the suspended coroutine, erase it from starved if it's destroyed before resumed.
+  auto wait_recycled(std::coroutine_handle<> *waiting) noexcept {
+    struct awaiter {
+      provided_buffer_group *g;
+      std::coroutine_handle<> *waiting;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> h) {
+        *waiting = h;
+        g->starved.push_back(h);
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{this, waiting};
+  }
 };
 }  // namespace detail
 
+inline void selected_buffer::recycled() noexcept {
+  if (group_ == nullptr) {
+    return;
+  }
+  group_->recycles++;
+  if (group_->starved.empty()) {
+    return;
+  }
+  auto h = group_->starved.front();
+  group_->starved.erase(group_->starved.begin());
+  h.resume();
+}
+
 struct buffer_group_iterator : std::vector<detail::provided_buffer_group>::const_iterator {};
 
 struct buffer_block_iterator : std::vector<char *>::const_iterator {};
@@ -123,16 +198,37 @@ class buffer_pool_base {
   typedef detail::buffer_id_t id_t;
   buffer_pool_base() = default;
 
+#ifndef NO_IO_CONTEXT
+  ~buffer_pool_base() {
+    for (auto &[gid, g] : map_) {
+      if (g.buf_ring == nullptr) {
+        continue;
+      }
+      // The ring may be gone already, so just unmap it, the kernel holds its own reference to the pages
+      // and the registration goes away with the ring (a.k.a. the group id can't be reused on that ring).
+      ::munmap(g.buf_ring, g.ring_entries * sizeof(io_uring_buf));
+    }
+  }
+#endif
+
   void return_back(selected_buffer &val) {
-    val.clear();
-    [[maybe_unused]] auto ret = ContextService::get_io_context_ref().provide_buffers(
-        const_cast<char *>(val.data()), static_cast<int>(val.size()), 1, val.group_id_, val.buf_id_);
+    if (!val.recycle_to_ring()) {
+      val.clear();
+      [[maybe_unused]] auto ret = ContextService::get_io_context_ref().provide_buffers(
+          const_cast<char *>(val.data()), static_cast<int>(val.size()), 1, val.group_id_, val.buf_id_);
+    }
+    val.recycled();
   }
 
   task<int> returned_back(selected_buffer &val) {
-    val.clear();
-    co_return co_await ContextService::get_io_context_ref().provide_buffers(
-        const_cast<char *>(val.data()), static_cast<int>(val.size()), 1, val.group_id_, val.buf_id_);
+    int ret = 0;
+    if (!val.recycle_to_ring()) {
+      val.clear();
+      ret = co_await ContextService::get_io_context_ref().provide_buffers(
+          const_cast<char *>(val.data()), static_cast<int>(val.size()), 1, val.group_id_, val.buf_id_);
+    }
+    val.recycled();
+    co_return ret;
   }
 
  private:
@@ -164,11 +260,44 @@ class buffer_pool_base {
     g_ref.blocks.reserve(10);
     for (char *cur = base; cur < base + (nbytes_per_block * how_many_blocks); cur += nbytes_per_block, i++) {
       // LDR("emplace one");
-      g_ref.blocks.emplace_back(selected_buffer{cur, nbytes_per_block, g_name, i});
+      g_ref.blocks.emplace_back(selected_buffer{cur, nbytes_per_block, g_name, i}).group_ = &g_ref;
       // LDR("emplaced: sz: %lu", g_ref.blocks.back().size());
     }
   }
 
+#ifndef NO_IO_CONTEXT
+  /// Same as provide_group_contiguous, but register a ring-mapped buffer group (IORING_REGISTER_PBUF_RING),
+  /// buffers are given back by a tail bump of the shared ring instead of a provide_buffers sqe.
+  /// Fallback to provide_group_contiguous if the kernel doesn't support it (before 5.19).
+  /// \param how_many_blocks at most 32768
+  async_task<> provide_group_ring(char *base, __u16 nbytes_per_block, int how_many_blocks, id_t g_name) {
+    auto &ring = ContextService::get_io_context_ref().get_ring_handle();
+    auto entries = std::bit_ceil(static_cast<unsigned>(how_many_blocks));
+    int ret = 0;
+    auto br = ::io_uring_setup_buf_ring(&ring, entries, g_name, 0, &ret);
+    if (br == nullptr) {
+      co_await provide_group_contiguous(base, nbytes_per_block, how_many_blocks, g_name);
+      co_return;
+    }
+    group_t &g_ref = get_or_create_group_by_id(g_name);
+    g_ref.group_id = g_name;
+    g_ref.nbytes_per_block = nbytes_per_block;
+    g_ref.buf_ring = br;
+    g_ref.ring_entries = entries;
+    auto mask = io_uring_buf_ring_mask(entries);
+    g_ref.blocks.reserve(how_many_blocks);
+    for (int i = 0; i < how_many_blocks; i++) {
+      char *cur = base + i * nbytes_per_block;
+      auto &b = g_ref.blocks.emplace_back(cur, nbytes_per_block, g_name, static_cast<__u16>(i));
+      b.buf_ring_ = br;
+      b.ring_mask_ = mask;
+      b.group_ = &g_ref;
+      io_uring_buf_ring_add(br, cur, nbytes_per_block, static_cast<__u16>(i), mask, i);
+    }
+    io_uring_buf_ring_advance(br, how_many_blocks);
+  }
+#endif
+
  private:
   inline auto find_group(id_t g_name) {
     auto it = map_.find(g_name);
@@ -179,15 +308,34 @@ class buffer_pool_base {
   }
 
  public:
+#ifndef NO_IO_CONTEXT
   /// RAII
   /// \param fd
   /// \param g_name
   /// \param nbytes
+  /// \param iflags IOSQE_* flags, e.g. IOSQE_FIXED_FILE if fd is a fixed file slot
+  /// \param stop the read is cancelled if a stop is requested, std::system_error(ECANCELED) is thrown then.
   /// \return
-  async_task<selected_buffer_resource<ContextService>> read(int fd, id_t g_name, off_t offset = 0) {
+  async_task<selected_buffer_resource<ContextService>, pooled_frames> read(int fd, id_t g_name, off_t offset = 0,
+                                                            uint8_t iflags = 0, std::stop_token stop = {}) {
     auto it = find_group(g_name);
     int nbytes = it->second.nbytes_per_block;
     // LOG_TRACE("co await read buffer_select");
+    auto ret = co_await with_stop(
+        ContextService::get_io_context_ref().read_buffer_select(fd, g_name, nbytes, offset, iflags), std::move(stop));
+    auto res = ret.first, flag = ret.second;
+    if (res <= 0) {
+      throw std::system_error(std::error_code{-res, std::system_category()});
+    }
+    auto &g = it->second;
+    g.blocks[flag].has_written(res);
+    co_return selected_buffer_resource<ContextService>{g.blocks[flag]};
+  }
+#else
+  /// Without a io_context (e.g. a mock ContextService), no sqe flags and no stop_token.
+  async_task<selected_buffer_resource<ContextService>> read(int fd, id_t g_name, off_t offset = 0) {
+    auto it = find_group(g_name);
+    int nbytes = it->second.nbytes_per_block;
     auto ret = co_await ContextService::get_io_context_ref().read_buffer_select(fd, g_name, nbytes, offset);
     auto res = ret.first, flag = ret.second;
     if (res <= 0) {
@@ -197,8 +345,70 @@ class buffer_pool_base {
     g.blocks[flag].has_written(res);
     co_return selected_buffer_resource<ContextService>{g.blocks[flag]};
   }
+#endif
+
+#ifndef NO_IO_CONTEXT
+  /// Receive with a single multishot recv request, every incoming segment comes as a selected buffer,
+  /// move it out of the iterator to hold it, or it's given back when the iterator moves on.
+  /// The request is re-armed when the kernel ends it, e.g. when the group runs dry (-ENOBUFS), in that case
+  /// it waits until a buffer of the group is given back (by the resource or return_back) before re-arming,
+  /// a.k.a. a consumer holding every buffer parks the stream instead of spinning it.
+  /// It's cancelled when the generator is destroyed.
+  /// \param fd a socket
+  /// \param g_name the group to select buffers from
+  /// \param iflags IOSQE_* flags, e.g. IOSQE_FIXED_FILE if fd is a fixed file slot
+  /// \return a async generator, it ends at EOF, throws on other errors.
+  async_generator<selected_buffer_resource<ContextService>> recv_stream(int fd, id_t g_name, uint8_t iflags = 0) {
+    auto &ctx = ContextService::get_io_context_ref();
+    auto &g = find_group(g_name)->second;
+    auto token = new detail::multishot_token{&drop_selected, &g};
+    std::coroutine_handle<> waiting{};
+    size_t armed_at = 0;
+    detail::on_scope_exit cancel_at_exit{[&ctx, &g, &waiting, token] {
+      std::erase(g.starved, waiting);
+      ctx.cancel_multishot(token);
+    }};
+    while (true) {
+      if (token->drained()) {
+        armed_at = g.recycles;
+        ctx.recv_multishot(fd, g_name, token, 0, iflags);
+      }
+      auto [res, flags] = co_await token->next();
+      if (res > 0) {
+        auto &b = g.blocks[flags >> IORING_CQE_BUFFER_SHIFT];
+        b.has_written(res);
+        co_yield selected_buffer_resource<ContextService>{b};
+      } else if (res == 0) {
+        co_return;
+      } else if (res == -ENOBUFS && armed_at == g.recycles) {
+        co_await g.wait_recycled(&waiting);
+      } else if (res == -ENOBUFS) {
+        // some came back after it's armed (may be taken by it already), just re-arm.
+        continue;
+      } else if (res != -EINTR && res != -EAGAIN) {
+        throw std::system_error(std::error_code{-res, std::system_category()});
+      }
+    }
+  }
+#endif
 
  private:
+#ifndef NO_IO_CONTEXT
+  /// a segment nobody would consume, give the buffer back.
+  static void drop_selected(void *group, int, __u32 flags) {
+    if (!(flags & IORING_CQE_F_BUFFER)) {
+      return;
+    }
+    auto &val = static_cast<group_t *>(group)->blocks[flags >> IORING_CQE_BUFFER_SHIFT];
+    if (!val.recycle_to_ring()) {
+      val.clear();
+      [[maybe_unused]] auto ret = ContextService::get_io_context_ref().provide_buffers(
+          const_cast<char *>(val.data()), static_cast<int>(val.size()), 1, val.group_id_, val.buf_id_);
+    }
+    val.recycled();
+  }
+#endif
+
   std::unordered_map<detail::buffer_id_t, group_t> map_{};
 };
 }  // namespace coring
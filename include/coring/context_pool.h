@@ -6,17 +6,148 @@
 #define CORING_CONTEXT_POOL_H
 #include <thread>
 #include <list>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <latch>
+#include <pthread.h>
+#include <sched.h>
 #include "io_context.hpp"
 #include "coring/detail/io_context_service.hpp"
 namespace coring {
-namespace detail{
-struct ctx_pool_worker{
+namespace detail {
+struct ctx_pool_worker {
   std::jthread thread;
-  io_context* context;
+  io_context *context;
 };
+/// pin the calling thread to a cpu, return false if the cpu is not available.
+inline bool pin_this_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
 }
-class context_pool {
-  std::list<std::jthread> threads_;
+}  // namespace detail
+
+/// A thread-per-core runtime, one io_context (one ring) per thread.
+///
+/// All rings are created from the first one with io_context::dup_from_big_brother,
+/// so that they share a single async backend (io-wq, and the SQPOLL thread if IORING_SETUP_SQPOLL is set).
+/// Tasks can be spawned from any thread, they would be placed to a context using round-robin or least-loaded
+/// policy, then run in that context thread until done, a.k.a. no work stealing.
+/// <p>Usage:</p>
+/// @code
+///  context_pool pool{4};
+///  pool.start();
+///  pool.spawn(some_task());
+///  // ...
+///  pool.stop(); // or just let the destructor do it
+/// @endcode
+class context_pool : noncopyable {
+ public:
+  enum class placement { round_robin, least_loaded };
+
+  /// \param threads how many io_context (and threads) to create, use all cpus by default
+  /// \param entries sq size of every ring
+  /// \param flags IORING_SETUP_* flags for the first ring, others would attach to it
+  /// \param pin_cpu pin the i-th thread to the i-th cpu (mod cpu count)
+  explicit context_pool(size_t threads = std::thread::hardware_concurrency(), int entries = 64, uint32_t flags = 0,
+                        bool pin_cpu = true)
+      : pin_cpu_{pin_cpu} {
+    if (threads == 0) {
+      threads = 1;
+    }
+    contexts_.reserve(threads);
+    contexts_.emplace_back(std::make_unique<io_context>(entries, flags));
+    auto bro = contexts_.front().get();
+    for (size_t i = 1; i < threads; i++) {
+      contexts_.emplace_back(new io_context{io_context::dup_from_big_brother(bro, entries)});
+    }
+  }
+
+  ~context_pool() { stop(); }
+
+  [[nodiscard]] size_t size() const { return contexts_.size(); }
+
+  io_context &operator[](size_t index) { return *contexts_[index]; }
+
+  /// Start all context threads, return after every loop is running.
+  void start() {
+    if (!workers_.empty()) {
+      return;
+    }
+    auto cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::latch all_ready{static_cast<std::ptrdiff_t>(contexts_.size())};
+    for (size_t i = 0; i < contexts_.size(); i++) {
+      auto ctx = contexts_[i].get();
+      auto cpu = static_cast<int>(i % cpus);
+      workers_.push_back(detail::ctx_pool_worker{std::jthread{[this, ctx, cpu, &all_ready] {
+                                                   if (pin_cpu_) {
+                                                     detail::pin_this_thread(cpu);
+                                                   }
+                                                   ctx->run(all_ready);
+                                                 }},
+                                                 ctx});
+    }
+    all_ready.wait();
+  }
+
+  /// Stop all loops and join all threads.
+  void stop() {
+    for (auto &w : workers_) {
+      w.context->stop();
+    }
+    // jthread joins on destruction
+    workers_.clear();
+  }
+
+  /// round-robin
+  io_context &next() {
+    auto i = next_.fetch_add(1, std::memory_order_relaxed);
+    return *contexts_[i % contexts_.size()];
+  }
+
+  /// the one with the fewest queued or alive tasks, ties go to the lower index.
+  io_context &least_loaded() {
+    io_context *res = contexts_.front().get();
+    auto min_load = res->load();
+    for (size_t i = 1; i < contexts_.size() && min_load != 0; i++) {
+      auto l = contexts_[i]->load();
+      if (l < min_load) {
+        min_load = l;
+        res = contexts_[i].get();
+      }
+    }
+    return *res;
+  }
+
+  io_context &pick(placement p) { return p == placement::least_loaded ? least_loaded() : next(); }
+
+  /// Spawn a task to one of the contexts, thread-safe.
+  /// \param t a lazy task, it would be started in the context thread.
+  /// \param p placement policy
+  /// \return the context the task goes to.
+  io_context &spawn(task<> &&t, placement p = placement::round_robin) {
+    auto &ctx = pick(p);
+    ctx.schedule(std::move(t));
+    return ctx;
+  }
+
+  /// Spawn a task to every context, useful to start per-thread acceptors/servers.
+  /// \param f called with the index of the context, returns a task<>.
+  template <typename TaskFactory>
+  void spawn_on_each(TaskFactory &&f) {
+    for (size_t i = 0; i < contexts_.size(); i++) {
+      contexts_[i]->schedule(f(i));
+    }
+  }
+
+ private:
+  // contexts_ must outlive workers_ (destroyed in reverse order).
+  std::vector<std::unique_ptr<io_context>> contexts_;
+  std::list<detail::ctx_pool_worker> workers_;
+  std::atomic<size_t> next_{0};
+  bool pin_cpu_;
 };
 }  // namespace coring
 #endif  // CORING_CONTEXT_POOL_H
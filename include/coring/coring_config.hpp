@@ -3,13 +3,47 @@
 #define CORING_CORING_CONFIG_HPP
 #include <cstddef>
 #define CORING_ASYNC_LOGGER_STDOUT
+// use the skiplist instead of the hierarchical timing wheel as the timer queue, cancelling is lazy then.
+// #define CORING_TIMER_USE_SKIPLIST
+// read the loop time with CLOCK_MONOTONIC_COARSE (cheaper, but only jiffy resolution, a.k.a. 1~4ms).
+// #define CORING_TIMER_COARSE_CLOCK
+// search delimiters in buffers with the scalar (memchr) kernel only, no SSE2/AVX2 even if the cpu has them.
+// #define CORING_NO_SIMD_SEARCH
 class CORING_TEST_CLASS;
 namespace coring {
 constexpr int BUFFER_DEFAULT_SIZE = 128;
 constexpr int READ_BUFFER_AT_LEAST_WRITABLE = 128;
+// flex_buffer storage up to it comes from per-thread freelists (power of 2 classes from 128B).
+constexpr size_t BUFFER_STORAGE_MAX_CLASS = 64 * 1024;
+// idle blocks a thread keeps per class, the rest are freed.
+constexpr unsigned BUFFER_STORAGE_IDLE_PER_CLASS = 64;
+// coroutine frames of task<T, pooled_frames> up to it come from per-thread freelists (power of 2 classes from 64B).
+constexpr size_t FRAME_ALLOCATOR_MAX_CLASS = 4096;
+// idle frames a thread keeps per class, the rest are freed.
+constexpr unsigned FRAME_ALLOCATOR_IDLE_PER_CLASS = 256;
+// initial ring of a ring_buffer, rounded up to pages.
+constexpr size_t RING_BUFFER_DEFAULT_SIZE = 64 * 1024;
+// line_reader (read_line, read_crlf_line) gives up on a line longer than it.
+constexpr size_t LINE_READER_MAX_LINE = 64 * 1024;
 constexpr size_t LOG_FILE_ROLLING_SZ = 40 * 1024 * 1024;
 constexpr size_t ASYNC_LOGGER_MAX_BUFFER = 1000 * 4000;
 constexpr size_t ASYNC_LOGGER_MAX_MESSAGE = 500;
 constexpr size_t ASYNC_LOGGER_RING_BUFFER_SZ = 8192;
+// the SQ thread of a SQPOLL ring (io_context::with_sqpoll) sleeps after idling so long (ms).
+constexpr unsigned SQPOLL_IDLE_MS = 1000;
+// a SQPOLL loop polls the CQ so many times (a pause each) before blocking in io_uring_enter.
+constexpr unsigned SQPOLL_CQ_POLLS = 2048;
+// how many cqes are copied out at once in batched reaping mode.
+constexpr unsigned CQE_REAP_BATCH = 64;
+// slots of the sparse fixed file table every io_context registers on demand.
+constexpr unsigned FIXED_FILE_TABLE_SIZE = 4096;
+// the last slots of it the kernel allocates for direct descriptors (accept_fd_stream(true)), the rest go by install().
+constexpr unsigned FIXED_FILE_DIRECT_SLOTS = 1024;
+// write_all_zc falls back to a copying send below it, pinning pages and the notification cost more than a memcpy.
+constexpr size_t SEND_ZC_THRESHOLD = 16 * 1024;
+// pipes for send_file, a splice moves one pipe at most, so larger pipes mean fewer rounds.
+constexpr int SPLICE_PIPE_SIZE = 256 * 1024;
+// idle pipes an io_context keeps, the rest are closed when they are given back.
+constexpr size_t PIPE_POOL_MAX_IDLE = 64;
 }  // namespace coring
 #endif  // CORING_CORING_CONFIG_HPP
@@ -0,0 +1,39 @@
+// frame_allocator.hpp
+// Created by PanJunzhong on 2022/5/27.
+//
+// Coroutine frames of task<T, pooled_frames>/async_task<T, pooled_frames>: per-thread freelists of size
+// classes, a.k.a. a frame made for every write_all/read of a message is a pop and a push, not a malloc/free.
+
+#ifndef CORING_FRAME_ALLOCATOR_HPP
+#define CORING_FRAME_ALLOCATOR_HPP
+#include <cstddef>
+#include "coring/coring_config.hpp"
+#include "coring/detail/size_class_freelist.hpp"
+
+namespace coring {
+/// Tags of task/async_task, frames from the global operator new (the default) or the per-thread freelists.
+struct default_frames {};
+struct pooled_frames {};
+
+namespace detail {
+/// Size classes are 64B, 128B ... FRAME_ALLOCATOR_MAX_CLASS, larger frames go to operator new directly.
+/// A frame freed on another thread (a task resumed by another io_context) joins the freelists of that thread.
+using frame_lists = size_class_freelist<64, FRAME_ALLOCATOR_MAX_CLASS, FRAME_ALLOCATOR_IDLE_PER_CLASS>;
+
+inline void *allocate_frame(size_t n) { return frame_lists::allocate(n); }
+
+/// \param n the same as allocated, the compiler passes it to the sized operator delete.
+inline void deallocate_frame(void *p, size_t n) noexcept { frame_lists::deallocate(p, n); }
+
+/// Base of the promises, the coroutine frame is allocated by promise_type::operator new if there is one.
+template <typename FrameTag>
+struct frame_allocation {};
+
+template <>
+struct frame_allocation<pooled_frames> {
+  static void *operator new(size_t n) { return allocate_frame(n); }
+  static void operator delete(void *p, size_t n) noexcept { deallocate_frame(p, n); }
+};
+}  // namespace detail
+}  // namespace coring
+#endif  // CORING_FRAME_ALLOCATOR_HPP
@@ -0,0 +1,55 @@
+// buffer_storage.hpp
+// Created by PanJunzhong on 2022/5/26.
+//
+// Backing storage of flex_buffer: per-thread freelists of power of 2 blocks, and an allocator that
+// default-initializes, a.k.a. vector::resize won't zero-fill the bytes recv/memcpy are going to overwrite.
+
+#ifndef CORING_BUFFER_STORAGE_HPP
+#define CORING_BUFFER_STORAGE_HPP
+#include <cstddef>
+#include <new>
+#include <vector>
+#include "coring/coring_config.hpp"
+#include "coring/detail/size_class_freelist.hpp"
+
+namespace coring::detail {
+/// Size classes are 128B, 256B ... BUFFER_STORAGE_MAX_CLASS, larger ones go to operator new directly.
+/// A block freed on another thread joins the freelists of that thread, nothing is shared between threads.
+using buffer_storage_lists = size_class_freelist<128, BUFFER_STORAGE_MAX_CLASS, BUFFER_STORAGE_IDLE_PER_CLASS>;
+
+inline void *allocate_buffer_storage(size_t n) { return buffer_storage_lists::allocate(n); }
+
+/// \param n the same as allocated.
+inline void deallocate_buffer_storage(void *p, size_t n) noexcept { buffer_storage_lists::deallocate(p, n); }
+
+/// For std::vector: storage from the freelists, and construct() without arguments leaves the value
+/// uninitialized (value-initialization is what zero-fills).
+template <typename T>
+struct buffer_storage_allocator {
+  using value_type = T;
+
+  buffer_storage_allocator() noexcept = default;
+  template <typename U>
+  buffer_storage_allocator(const buffer_storage_allocator<U> &) noexcept {}
+
+  T *allocate(size_t n) { return static_cast<T *>(allocate_buffer_storage(n * sizeof(T))); }
+  void deallocate(T *p, size_t n) noexcept { deallocate_buffer_storage(p, n * sizeof(T)); }
+
+  template <typename U>
+  void construct(U *p) noexcept {
+    ::new (static_cast<void *>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U *p, Args &&...args) {
+    ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U>
+  bool operator==(const buffer_storage_allocator<U> &) const noexcept {
+    return true;
+  }
+};
+
+using buffer_storage = std::vector<char, buffer_storage_allocator<char>>;
+}  // namespace coring::detail
+#endif  // CORING_BUFFER_STORAGE_HPP
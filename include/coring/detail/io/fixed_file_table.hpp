@@ -0,0 +1,109 @@
+// fixed_file_table.hpp
+// Created by PanJunzhong on 2022/5/18.
+//
+// A sparse registered (fixed) file table per ring, the slots are handed out and recycled by us, except a range
+// at the end of it where the kernel allocates slots for direct descriptors (e.g. accept_fd_stream(true)).
+// A op on a fixed file (IOSQE_FIXED_FILE) saves the kernel a fget/fput pair, which is not free for
+// sockets shared by threads (the file refcount is atomic), see io_uring_register(2) IORING_REGISTER_FILES.
+
+#ifndef CORING_FIXED_FILE_TABLE_HPP
+#define CORING_FIXED_FILE_TABLE_HPP
+#include <vector>
+#include <liburing.h>
+#include "coring/coring_config.hpp"
+#include "coring/detail/noncopyable.hpp"
+
+namespace coring::detail {
+/// It's the only owner of the file table of the ring: slots [0, capacity - direct_slots) go by install(),
+/// the last direct_slots ones are left to the kernel (IORING_REGISTER_FILE_ALLOC_RANGE), so both can be used at once.
+/// The table is registered lazily at the first install() or ensure_registered(), if it fails (e.g. someone has
+/// registered a table of this ring already, or the kernel is too old) all installs fail afterwards, callers just
+/// keep using fds. Without the alloc range (kernel < 6.0) the kernel may pick any slot, installs fail then too.
+/// Not thread-safe, use it on the thread of the ring.
+class fixed_file_table : noncopyable {
+ public:
+  explicit fixed_file_table(::io_uring *ring, unsigned capacity = FIXED_FILE_TABLE_SIZE,
+                            unsigned direct_slots = FIXED_FILE_DIRECT_SLOTS)
+      : ring_{ring}, capacity_{capacity}, direct_slots_{direct_slots < capacity ? direct_slots : capacity} {}
+
+  /// Put the file into a free slot, the table holds a reference of the file until the slot is released,
+  /// a.k.a. closing the fd alone won't close the file.
+  /// \return the slot index, -1 if the table is full or not available.
+  int install(int fd) {
+    if (fd < 0 || !ensure_registered() || !installable_) {
+      return -1;
+    }
+    int slot;
+    if (!free_.empty()) {
+      slot = free_.back();
+      free_.pop_back();
+    } else if (next_ < capacity_ - direct_slots_) {
+      slot = static_cast<int>(next_++);
+    } else {
+      return -1;
+    }
+    if (::io_uring_register_files_update(ring_, slot, &fd, 1) != 1) {
+      free_.push_back(slot);
+      return -1;
+    }
+    in_use_++;
+    return slot;
+  }
+
+  /// Clear the slot (drop the reference) and recycle it.
+  void release(int slot) {
+    if (slot < 0) {
+      return;
+    }
+    int empty = -1;
+    ::io_uring_register_files_update(ring_, slot, &empty, 1);
+    free_.push_back(slot);
+    in_use_--;
+  }
+
+  /// Clear a slot the kernel allocated for a direct descriptor, the kernel may hand it out again then.
+  void release_direct(int slot) {
+    int empty = -1;
+    ::io_uring_register_files_update(ring_, slot, &empty, 1);
+  }
+
+  /// Ask acceptor and connect_to to install the sockets they create.
+  void set_auto_install(bool on) { auto_install_ = on; }
+
+  [[nodiscard]] bool auto_install() const { return auto_install_; }
+
+  [[nodiscard]] unsigned capacity() const { return capacity_; }
+
+  /// \return the first slot of the kernel allocated range, direct descriptors are in [direct_begin(), capacity()).
+  [[nodiscard]] unsigned direct_begin() const { return capacity_ - direct_slots_; }
+
+  [[nodiscard]] size_t in_use() const { return in_use_; }
+
+  /// Register the table and the kernel allocated range, ops with direct descriptors need it done before.
+  /// \return false if the table can't be registered.
+  bool ensure_registered() {
+    if (state_ == 0) {
+      state_ = ::io_uring_register_files_sparse(ring_, capacity_) == 0 ? 1 : -1;
+      if (state_ == 1 && direct_slots_ > 0) {
+        installable_ = ::io_uring_register_file_alloc_range(ring_, direct_begin(), direct_slots_) == 0;
+      }
+    }
+    return state_ == 1;
+  }
+
+ private:
+  ::io_uring *ring_;
+  unsigned capacity_;
+  unsigned direct_slots_;
+  // 0: not tried yet, 1: registered, -1: failed.
+  int state_{0};
+  // false if the kernel may allocate slots anywhere in the table.
+  bool installable_{true};
+  bool auto_install_{false};
+  size_t in_use_{0};
+  // slots never handed out start from here, the recycled ones are in free_.
+  unsigned next_{0};
+  std::vector<int> free_{};
+};
+}  // namespace coring::detail
+#endif  // CORING_FIXED_FILE_TABLE_HPP
@@ -8,17 +8,21 @@
 #include <type_traits>
 #include <cassert>
 #include <functional>
+#include <deque>
+#include <utility>
 
 #include <coroutine>
 #include "coring/logging.hpp"
+#include "coring/detail/noncopyable.hpp"
 
 namespace coring::detail {
-// encapsulated to io_uring_context user data as completion token
+class io_uring_context;
+
+// encapsulated to io_uring_context user data as completion token.
+// The state of a request (continuation, result, flags) lives in the awaiter, its address is the user_data of the
+// sqe and the cancel key, a.k.a. nothing is allocated per request.
 struct io_token {
   friend struct io_awaitable_base;
-  friend struct io_awaitable;
-  friend struct io_awaitable_flag;
-  friend struct io_awaitable_res_flag;
 
   // result is a int value (same as system call)
   // https://github.com/axboe/liburing/issues/6
@@ -27,124 +31,206 @@ struct io_token {
     this->result = res;
     this->flags = fl;
     // LOG_TRACE("resolve a result, ptr:{}, result: {},flag:{}", continuation.address(), res, fl);
-    continuation.resume();
+    // a io_loop_awaiter goes on with another sqe on this token, nobody is resumed then.
+    if (step != nullptr && step(this)) {
+      return;
+    }
+    std::exchange(continuation, nullptr).resume();
   }
 
- private:
-  std::coroutine_handle<> continuation;
+  /// co_awaited and not completed yet.
+  [[nodiscard]] bool in_flight() const noexcept { return continuation != nullptr; }
+
+  /// Ask the kernel to cancel it (IORING_OP_ASYNC_CANCEL by the user_data), it completes with -ECANCELED then,
+  /// or with its own result if it's done first. The cancel sqe is detached, nothing is allocated.
+  /// NOTICE: call it on the thread of the io_context it's submitted to.
+  /// \return false if it's not in flight.
+  bool cancel() noexcept;
+
+ protected:
+  std::coroutine_handle<> continuation{nullptr};
   int result = 0;
   __u32 flags = 0;
+  // called on every result before the continuation is resumed, true if the token is armed again.
+  bool (*step)(io_token *) noexcept = nullptr;
+  // where the sqe goes, for cancel().
+  io_uring_context *ring = nullptr;
 };
 
 static_assert(std::is_trivially_destructible_v<io_token>);
+
+/// Completion token of a multishot request (accept, recv...), a.k.a. one sqe and many cqes with the same user_data.
+/// The kernel may post cqes when nobody is co_awaiting, so results are buffered here.
+/// It's heap allocated since the owner may go away while the request is still armed, and it's tagged with
+/// the lowest bit in user_data so that handle_completions can tell it from a io_token.
+/// Check io_uring_context::cancel_multishot for the ending of a token.
+/// It can be armed by more than one sqe (e.g. pipelined zero-copy sends, each has a result and a notification cqe),
+/// it's armed until all of them post the last cqe.
+struct multishot_token : noncopyable {
+  /// called on results that nobody would consume after the owner is gone, e.g. close the accepted fd.
+  typedef void (*drop_func_t)(void *arg, int res, __u32 flags);
+  static constexpr uintptr_t TAG = 0x1;
+
+  explicit multishot_token(drop_func_t drop = nullptr, void *drop_arg = nullptr) : drop_{drop}, drop_arg_{drop_arg} {}
+
+  static bool is_multishot(void *user_data) noexcept { return reinterpret_cast<uintptr_t>(user_data) & TAG; }
+  static multishot_token *from_user_data(void *user_data) noexcept {
+    return reinterpret_cast<multishot_token *>(reinterpret_cast<uintptr_t>(user_data) & ~TAG);
+  }
+  [[nodiscard]] void *user_data() noexcept { return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(this) | TAG); }
+
+  void resolve(int res, __u32 fl) {
+    // the last cqe of a multishot request comes without IORING_CQE_F_MORE.
+    if (!(fl & IORING_CQE_F_MORE) && armed_ != 0) {
+      armed_--;
+    }
+    if (detached_) {
+      drop(res, fl);
+      if (armed_ == 0) {
+        delete this;
+      }
+      return;
+    }
+    completions_.emplace_back(res, fl);
+    if (waiter_) {
+      std::exchange(waiter_, nullptr).resume();
+    }
+  }
+
+  /// the sqe is a multishot one, bind it to this token.
+  void arm(io_uring_sqe *sqe) noexcept {
+    armed_++;
+    io_uring_sqe_set_data(sqe, user_data());
+  }
+
+  /// the kernel may still post cqes.
+  [[nodiscard]] bool armed() const noexcept { return armed_ != 0; }
+
+  /// nothing more to co_await, need to re-arm then.
+  [[nodiscard]] bool drained() const noexcept { return armed_ == 0 && completions_.empty(); }
+
+  /// co_await the next cqe, make sure !drained() before this.
+  /// \return {res, cqe flags}
+  auto next() noexcept {
+    struct awaiter {
+      multishot_token *token;
+      [[nodiscard]] bool await_ready() const noexcept { return !token->completions_.empty(); }
+      void await_suspend(std::coroutine_handle<> h) noexcept { token->waiter_ = h; }
+      std::pair<int, __u32> await_resume() noexcept {
+        assert(!token->completions_.empty());
+        auto res = token->completions_.front();
+        token->completions_.pop_front();
+        return res;
+      }
+    };
+    assert(!drained());
+    return awaiter{this};
+  }
+
+  /// the owner is going away, drop all buffered results,
+  /// \return true if it should be deleted now, or it deletes itself at the last cqe.
+  bool detach() noexcept {
+    detached_ = true;
+    for (auto [res, fl] : completions_) {
+      drop(res, fl);
+    }
+    completions_.clear();
+    return armed_ == 0;
+  }
+
+ private:
+  void drop(int res, __u32 fl) {
+    if (drop_ != nullptr && res >= 0) {
+      drop_(drop_arg_, res, fl);
+    }
+  }
+
+  std::deque<std::pair<int, __u32>> completions_{};
+  std::coroutine_handle<> waiter_{nullptr};
+  drop_func_t drop_;
+  void *drop_arg_;
+  // how many requests may still post cqes.
+  unsigned armed_{0};
+  bool detached_{false};
+};
+static_assert(alignof(multishot_token) > multishot_token::TAG);
 }  // namespace coring::detail
 
 namespace coring {
 
 struct io_cancel_token {
-  typedef detail::io_token *const const_ptr;
-  typedef const detail::io_token *const data_t;
-  typedef const data_t *const data_ptr_t;
-  data_ptr_t token_ptr;
-  explicit io_cancel_token(data_ptr_t ptr) : token_ptr{ptr} {}
-  bool is_cancellable() const { return *token_ptr != nullptr; }
-  [[nodiscard]] void *get_cancel_key() const { return (void *)*token_ptr; }
+  const detail::io_token *token;
+  explicit io_cancel_token(const detail::io_token *token) : token{token} {}
+  [[nodiscard]] bool is_cancellable() const { return token->in_flight(); }
+  [[nodiscard]] void *get_cancel_key() const { return (void *)token; }
 };
 
 }  // namespace coring
 
 namespace coring::detail {
-struct io_awaitable_base {
-  io_awaitable_base(io_uring_sqe *sqe) noexcept : sqe(sqe) { io_uring_sqe_set_data(sqe, nullptr); }
-
-  auto operator co_await() {
-    struct uio_awaiter {
-      io_token token{};
-      io_uring_sqe *sqe;
-
-      uio_awaiter(io_uring_sqe *sqe) : sqe(sqe) {}
-      uio_awaiter(io_uring_sqe *sqe, io_token **token_ptr_place) : sqe(sqe) { *token_ptr_place = &token; }
+/// A sqe and the awaiter of it at once: co_await binds the sqe to the token inside (the user_data), so it's not
+/// moved after that (it's in the frame of the awaiting coroutine, it won't be).
+/// <p>Usage:</p>
+/// @code
+///  auto op = ctx.recv(fd, buf, n, 0);
+///  stop_callback cb{token, [&op] { op.cancel(); }};
+///  int n = co_await op;  // -ECANCELED if it's cancelled
+/// @endcode
+struct io_awaitable_base : io_token {
+  io_awaitable_base(io_uring_sqe *sqe, io_uring_context *ctx) noexcept : sqe(sqe) {
+    ring = ctx;
+    io_uring_sqe_set_data(sqe, nullptr);
+  }
 
-      constexpr bool await_ready() const noexcept { return false; }
+  constexpr bool await_ready() const noexcept { return false; }
 
-      void await_suspend(std::coroutine_handle<> continuation) noexcept {
-        // use info symbol [address] in gdb
-        // LOG_TRACE("get a continuation: {}", continuation.address());
-        token.continuation = continuation;
-        io_uring_sqe_set_data(sqe, &token);
-      }
+  void await_suspend(std::coroutine_handle<> h) noexcept {
+    // use info symbol [address] in gdb
+    // LOG_TRACE("get a continuation: {}", h.address());
+    continuation = h;
+    io_uring_sqe_set_data(sqe, static_cast<io_token *>(this));
+  }
 
-      constexpr int await_resume() const noexcept { return token.result; }
-    };
+  /// It's cancellable only after this is co_awaited (and before it's resumed), check coring::with_timeout.
+  io_cancel_token get_cancel_token() const noexcept { return io_cancel_token{this}; }
 
-    return uio_awaiter(sqe, &token_ptr);
-  }
-  io_cancel_token get_cancel_token() {
-    // TODO: this won't work at all... trying to find a solution
-    // a point is when io_awaitable is created, it stat and detached.
-    return io_cancel_token{&token_ptr};
+  /// Complete the sqe on a token living somewhere else (a io_loop_awaiter), instead of co_await it.
+  void bind(io_token *token) noexcept {
+    token->ring = ring;
+    io_uring_sqe_set_data(sqe, token);
   }
 
+  /// IOSQE_IO_LINK, the next sqe (e.g. a link_timeout) starts after this one.
+  void link() noexcept { sqe->flags |= IOSQE_IO_LINK; }
+
  protected:
   io_uring_sqe *sqe;
-  io_token *token_ptr{nullptr};
-};
-struct io_awaitable : io_awaitable_base {
-  io_awaitable(io_uring_sqe *sqe) noexcept : io_awaitable_base{sqe} {}
 };
-struct io_awaitable_flag : io_awaitable_base {
-  io_awaitable_flag(io_uring_sqe *sqe) noexcept : io_awaitable_base{sqe} {}
-
-  auto operator co_await() {
-    struct uio_awaiter {
-      io_token token{};
-      io_uring_sqe *sqe;
-
-      uio_awaiter(io_uring_sqe *sqe) : sqe(sqe) {}
-      uio_awaiter(io_uring_sqe *sqe, io_token **token_ptr_place) : sqe(sqe) { *token_ptr_place = &token; }
 
-      constexpr bool await_ready() const noexcept { return false; }
+struct io_awaitable : io_awaitable_base {
+  using io_awaitable_base::io_awaitable_base;
 
-      void await_suspend(std::coroutine_handle<> continuation) noexcept {
-        token.continuation = continuation;
-        io_uring_sqe_set_data(sqe, &token);
-      }
+  [[nodiscard]] int await_resume() const noexcept { return result; }
+};
 
-      constexpr int await_resume() const noexcept {
-        if (token.result <= 0) {
-          return token.result;
-        }
-        return (int)(token.flags >> IORING_CQE_BUFFER_SHIFT);
-      }
-    };
+/// The result is the id of the selected buffer (or the error).
+struct io_awaitable_flag : io_awaitable_base {
+  using io_awaitable_base::io_awaitable_base;
 
-    return uio_awaiter(sqe, &token_ptr);
+  [[nodiscard]] int await_resume() const noexcept {
+    if (result <= 0) {
+      return result;
+    }
+    return (int)(flags >> IORING_CQE_BUFFER_SHIFT);
   }
 };
-struct io_awaitable_res_flag : io_awaitable_base {
-  io_awaitable_res_flag(io_uring_sqe *sqe) noexcept : io_awaitable_base{sqe} {}
-
-  auto operator co_await() {
-    struct uio_awaiter {
-      io_token token{};
-      io_uring_sqe *sqe;
-
-      uio_awaiter(io_uring_sqe *sqe) : sqe(sqe) {}
-      uio_awaiter(io_uring_sqe *sqe, io_token **token_ptr_place) : sqe(sqe) { *token_ptr_place = &token; }
 
-      constexpr bool await_ready() const noexcept { return false; }
-
-      void await_suspend(std::coroutine_handle<> continuation) noexcept {
-        token.continuation = continuation;
-        io_uring_sqe_set_data(sqe, &token);
-      }
-
-      constexpr std::pair<int, int> await_resume() const noexcept {
-        return std::make_pair(token.result, (int)(token.flags >> IORING_CQE_BUFFER_SHIFT));
-      }
-    };
+/// The result is {res, the id of the selected buffer}.
+struct io_awaitable_res_flag : io_awaitable_base {
+  using io_awaitable_base::io_awaitable_base;
 
-    return uio_awaiter(sqe, &token_ptr);
+  [[nodiscard]] std::pair<int, int> await_resume() const noexcept {
+    return std::make_pair(result, (int)(flags >> IORING_CQE_BUFFER_SHIFT));
   }
 };
 }  // namespace coring::detail
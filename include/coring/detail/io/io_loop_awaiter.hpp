@@ -0,0 +1,98 @@
+// io_loop_awaiter.hpp
+// Created by PanJunzhong on 2022/5/28.
+//
+// Requests that may take more than one sqe (the rest of a short write, recv until a line is in) as plain
+// awaiters: every round is a sqe completed on the same io_token, the awaiting coroutine is resumed once at the end,
+// a.k.a. no coroutine frame (and no indirection through one) per helper.
+
+#ifndef CORING_IO_LOOP_AWAITER_HPP
+#define CORING_IO_LOOP_AWAITER_HPP
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <linux/time_types.h>
+#include "coring/io_context.hpp"
+#include "coring/detail/io/io_awaitable.hpp"
+
+namespace coring::detail {
+/// Rounds without a timeout.
+struct no_timeout {};
+
+/// Lazy, nothing is submitted before co_await. Derived provides:
+///  - bool ready(): true if there is nothing to submit, it may throw (to the awaiting coroutine).
+///  - void submit(): prep the sqe of the next round and arm() it.
+///  - bool on_result(int res): consume the result of a round, true if another round follows,
+///    what it throws is rethrown by rethrow_if_failed() in await_resume.
+/// \tparam Timeout no_timeout, or __kernel_timespec: every round is linked with a timeout of it.
+template <typename Derived, typename Timeout = no_timeout>
+class io_loop_awaiter : public io_token {
+ public:
+  explicit io_loop_awaiter(Timeout timeout = {}) noexcept : timeout_{timeout} { step = &next_round; }
+
+  bool await_ready() { return self()->ready(); }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    continuation = h;
+    self()->submit();
+  }
+
+ protected:
+  void arm(io_awaitable_base &&op) {
+    op.bind(this);
+    if constexpr (!std::is_same_v<Timeout, no_timeout>) {
+      op.link();
+      coro::get_io_context_ref().link_timeout(&timeout_);
+    }
+  }
+
+  [[nodiscard]] int last_result() const noexcept { return result; }
+
+  void rethrow_if_failed() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  Derived *self() noexcept { return static_cast<Derived *>(this); }
+
+  static bool next_round(io_token *token) noexcept {
+    auto self = static_cast<Derived *>(static_cast<io_loop_awaiter *>(token));
+    try {
+      if (self->on_result(self->result)) {
+        self->submit();
+        return true;
+      }
+    } catch (...) {
+      self->error_ = std::current_exception();
+    }
+    return false;
+  }
+
+  // the kernel reads it at the submission.
+  [[no_unique_address]] Timeout timeout_;
+  std::exception_ptr error_{};
+};
+
+/// A single request linked with a timeout, the timespec lives in the awaiter until it's completed.
+/// \tparam Prep returns the io_awaitable of the request.
+template <typename Prep>
+class linked_timeout_awaiter : public io_loop_awaiter<linked_timeout_awaiter<Prep>, __kernel_timespec> {
+  typedef io_loop_awaiter<linked_timeout_awaiter<Prep>, __kernel_timespec> base_t;
+  friend base_t;
+
+ public:
+  linked_timeout_awaiter(Prep prep, __kernel_timespec timeout) : base_t{timeout}, prep_{std::move(prep)} {}
+
+  /// \return the result of the request, -ECANCELED if it's timed out.
+  int await_resume() noexcept { return this->last_result(); }
+
+ private:
+  bool ready() noexcept { return false; }
+  void submit() { this->arm(prep_()); }
+  bool on_result(int) noexcept { return false; }
+
+  Prep prep_;
+};
+}  // namespace coring::detail
+#endif  // CORING_IO_LOOP_AWAITER_HPP
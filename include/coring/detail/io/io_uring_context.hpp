@@ -6,6 +6,8 @@
 
 #include <system_error>
 #include <chrono>
+#include <bitset>
+#include <thread>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -15,6 +17,7 @@
 #include <execinfo.h>
 #endif
 
+#include "coring/coring_config.hpp"
 #include "coring/detail/time_utils.hpp"
 #include "coring/detail/noncopyable.hpp"
 #include "io_awaitable.hpp"
@@ -43,6 +46,9 @@ namespace coring::detail {
 // OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 class io_uring_context : noncopyable {
  public:
+  /// user_data of the cqe posted to a ring by IORING_OP_MSG_RING from another ring, only used to wake it up.
+  static constexpr __u64 UDATA_MSG_RING_WAKEUP = LIBURING_UDATA_TIMEOUT - 1;
+
   /** Init uio / io_uring_context object
    * @see io_uring_setup(2)
    * @param entries Maximum sqe can be gotten without submitting
@@ -60,6 +66,7 @@ class io_uring_context : noncopyable {
         .wq_fd = wq_fd,
     };
     io_uring_queue_init_params(entries, &ring, &p) | panic_on_err("queue_init_params", false);
+    probe_opcodes();
   }
   /**
    * For multi-thread or SQPOLL usage
@@ -77,10 +84,12 @@ class io_uring_context : noncopyable {
    */
   io_uring_context(int entries, io_uring_params p) {
     io_uring_queue_init_params(entries, &ring, &p) | panic_on_err("queue_init_params", false);
+    probe_opcodes();
   }
 
   io_uring_context(int entries, io_uring_params *p) {
     io_uring_queue_init_params(entries, &ring, p) | panic_on_err("queue_init_params", false);
+    probe_opcodes();
   }
 
   /** Destroy uio / io_uring_context object */
@@ -88,30 +97,89 @@ class io_uring_context : noncopyable {
   virtual ~io_uring_context() noexcept { io_uring_queue_exit(&ring); }
 
  public:
-  inline void wait_for_completions(int min_c = 1) { io_uring_submit_and_wait(&ring, min_c); }
+  /// Params of a SQPOLL ring: the kernel thread picks sqes up by the SQ tail, so no io_uring_enter to submit.
+  /// \param cpu pin the SQ thread to it (IORING_SETUP_SQ_AFF), -1 to let it float.
+  /// \param idle_ms the SQ thread sleeps after idling so long, it needs a wakeup (IORING_SQ_NEED_WAKEUP) then.
+  static io_uring_params sqpoll_params(int cpu = -1, unsigned idle_ms = SQPOLL_IDLE_MS) noexcept {
+    io_uring_params p{};
+    p.flags = IORING_SETUP_SQPOLL;
+    if (cpu >= 0) {
+      p.flags |= IORING_SETUP_SQ_AFF;
+      p.sq_thread_cpu = static_cast<__u32>(cpu);
+    }
+    p.sq_thread_idle = idle_ms;
+    return p;
+  }
+
+  [[nodiscard]] bool sqpoll() const noexcept { return ring.flags & IORING_SETUP_SQPOLL; }
+
+  inline void wait_for_completions(int min_c = 1) { wait_for_completions(min_c, nullptr); }
+
+  /// Submit and wait at most ts, with IORING_FEAT_EXT_ARG the timeout is passed to io_uring_enter
+  /// directly so it costs no sqe, or liburing would queue a IORING_OP_TIMEOUT (LIBURING_UDATA_TIMEOUT) for us.
+  /// With SQPOLL, check sqpoll_wait.
+  /// \param ts relative timeout, nullptr to wait forever.
+  inline void wait_for_completions(int min_c, __kernel_timespec *ts) {
+    if (sqpoll()) {
+      return sqpoll_wait(min_c, ts);
+    }
+    ++submit_stats_.enters;
+    enter(min_c, ts);
+  }
+
+  /// Counters of the submission side, check submit_stats().
+  struct submit_stats_t {
+    // io_uring_enter calls made by wait_for_completions (to submit, to wake the SQ thread up, or to wait).
+    uint64_t enters{0};
+    // SQPOLL only: rounds done without io_uring_enter, the SQ thread was awake, and the cqes were there
+    // (or found by polling the CQ) or not waited for. Roughly, the SQ thread may fall asleep in between.
+    uint64_t enters_avoided{0};
+    // SQPOLL only: times the SQ thread was asleep (IORING_SQ_NEED_WAKEUP) when there were sqes to submit.
+    uint64_t sq_wakeups{0};
+  };
+
+  [[nodiscard]] const submit_stats_t &submit_stats() const noexcept { return submit_stats_; }
+
+  /// Counters of the completion side, check reap_stats().
+  struct reap_stats_t {
+    // cqes handled
+    uint64_t cqes{0};
+    // times handle_completions found cqes
+    uint64_t rounds{0};
+    // times the kernel had cqes in its overflow backlog (IORING_SQ_CQ_OVERFLOW) when we reaped, the CQ is too small.
+    uint64_t overflow_backlogged{0};
+    // cqes the kernel dropped (the overflow counter of the CQ ring), only on kernels without IORING_FEAT_NODROP.
+    uint64_t overflow_dropped{0};
+  };
 
   void handle_completions() {
-    io_uring_cqe *cqe;
-    unsigned head;
-    io_uring_for_each_cqe(&ring, head, cqe) {
-      ++cqe_count;
-      auto coro = static_cast<io_token *>(io_uring_cqe_get_data(cqe));
-      // support the timeout enter, if we have kernel support EXT_ARG
-      // then this would be unnecessary
-      if (coro != nullptr && coro != reinterpret_cast<void *>(LIBURING_UDATA_TIMEOUT)) {
-        coro->resolve(cqe->res, cqe->flags);
-      }
-      //      } else {
-      //        LOG_TRACE("a detached event {} returns a result: res: {}, flag: {}", (void *)coro, cqe->res,
-      //        cqe->flags);
-      //      }
+    if (io_uring_cq_has_overflow(&ring)) {
+      ++stats_.overflow_backlogged;
     }
-    io_uring_cq_advance(&ring, cqe_count);
-    cqe_count = 0;
+    if (batched_reaping_) {
+      handle_completions_batched();
+    } else {
+      handle_completions_inline();
+    }
+    stats_.overflow_dropped = IO_URING_READ_ONCE(*ring.cq.koverflow);
+  }
+
+  /// By default every continuation is resumed right inside of the CQ iteration, so the CQ head is not advanced until
+  /// all of them return (or suspend again). When on, a batch of cqes is copied out and the head is advanced first,
+  /// then continuations are resumed from the copy, a.k.a. CQ space is released before any long handler runs.
+  void set_batched_reaping(bool on) noexcept { batched_reaping_ = on; }
+
+  [[nodiscard]] bool batched_reaping() const noexcept { return batched_reaping_; }
+
+  [[nodiscard]] const reap_stats_t &reap_stats() const noexcept { return stats_; }
+
+  inline void wait_for_completions_then_handle(int min_c = 1) {
+    wait_for_completions(min_c);
+    handle_completions();
   }
 
-  inline void wait_for_completions_then_handle() {
-    wait_for_completions();
+  inline void wait_for_completions_then_handle(int min_c, __kernel_timespec *ts) {
+    wait_for_completions(min_c, ts);
     handle_completions();
   }
 
@@ -175,6 +243,16 @@ class io_uring_context : noncopyable {
     return make_awaitable(sqe, iflags);
   }
 
+  /// Cancel requests on a fd (IORING_ASYNC_CANCEL_FD) instead of a user_data, all of them by default,
+  /// e.g. the pending recv/send of a connection to drain. Available since 5.19.
+  /// \param fixed `fd` is a fixed file slot.
+  /// \return how many are cancelled (with IORING_ASYNC_CANCEL_ALL), -ENOENT if none.
+  io_awaitable cancel_fd(int fd, bool fixed = false, unsigned flags = IORING_ASYNC_CANCEL_ALL, uint8_t iflags = 0) {
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_cancel_fd(sqe, fd, flags | (fixed ? IORING_ASYNC_CANCEL_FD_FIXED : 0));
+    return make_awaitable(sqe, iflags);
+  }
+
   /** Read data into multiple buffers asynchronously
    * @see preadv2(2)
    * @see io_uring_enter(2) IORING_OP_READV
@@ -265,6 +343,21 @@ class io_uring_context : noncopyable {
     return make_awaitable_res_flag(sqe, iflags);
   }
 
+  /** Post a cqe to another ring asynchronously
+   * The target ring would get a cqe with res = len and user_data = data, a.k.a. an inter-ring doorbell.
+   * The sqe is submitted by this ring, so it costs no extra syscall when the loop is about to submit anyway.
+   * Available since 5.18.
+   * @see io_uring_enter(2) IORING_OP_MSG_RING
+   * @param fd the ring_fd of the target ring
+   * @param iflags IOSQE_* flags
+   * @return a task object for awaiting, 0 or -errno (e.g. -EOVERFLOW if the target cq is full)
+   */
+  io_awaitable msg_ring(int fd, unsigned len, __u64 data, unsigned flags = 0, uint8_t iflags = 0) noexcept {
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_msg_ring(sqe, fd, len, data, flags);
+    return make_awaitable(sqe, iflags);
+  }
+
   /** Synchronize a file's in-core state with storage device asynchronously
    * @see fsync(2)
    * @see io_uring_enter(2) IORING_OP_FSYNC
@@ -328,6 +421,22 @@ class io_uring_context : noncopyable {
     return make_awaitable(sqe, iflags);
   }
 
+  /** Receive from a socket into selected buffers, one sqe for many segments
+   * Every segment posts a cqe with IORING_CQE_F_MORE set and a buffer id from the group,
+   * the last cqe (error, EOF, or -ENOBUFS when the group runs dry) comes without it. Available since 6.0.
+   * @see io_uring_enter(2) IORING_OP_RECV, IORING_RECV_MULTISHOT, IOSQE_BUFFER_SELECT
+   * @param gid the buffer group
+   * @param token results go to it, make sure it's drained before arming it again
+   * @param iflags IOSQE_* flags
+   */
+  void recv_multishot(int sockfd, __u16 gid, multishot_token *token, int flags = 0, uint8_t iflags = 0) noexcept {
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_recv_multishot(sqe, sockfd, nullptr, 0, flags);
+    sqe->buf_group = gid;
+    io_uring_sqe_set_flags(sqe, iflags | IOSQE_BUFFER_SELECT);
+    token->arm(sqe);
+  }
+
   /** Send a message on a socket asynchronously
    * @see send(2)
    * @see io_uring_enter(2) IORING_OP_SEND
@@ -340,6 +449,39 @@ class io_uring_context : noncopyable {
     return make_awaitable(sqe, iflags);
   }
 
+  /** Send on a socket without copying the data into the socket buffer
+   * Two cqes are posted to the token: the result (with IORING_CQE_F_MORE if a notification follows), then
+   * the notification (IORING_CQE_F_NOTIF) when the kernel is done with the buffer, a.k.a. the buffer must be kept
+   * alive and untouched until then. Available since 6.0.
+   * @see io_uring_enter(2) IORING_OP_SEND_ZC
+   * @param zc_flags IORING_RECVSEND_* / IORING_SEND_ZC_*
+   * @param buf_index the index of a registered buffer (the one buf lies in) or -1
+   * @param token results go to it, it can be armed by many sends at the same time
+   * @param iflags IOSQE_* flags
+   */
+  void send_zc(int sockfd, const void *buf, size_t nbytes, int flags, multishot_token *token, unsigned zc_flags = 0,
+               int buf_index = -1, uint8_t iflags = 0) noexcept {
+    auto *sqe = io_uring_get_sqe_safe();
+    if (buf_index >= 0) {
+      io_uring_prep_send_zc_fixed(sqe, sockfd, buf, nbytes, flags, zc_flags, static_cast<unsigned>(buf_index));
+    } else {
+      io_uring_prep_send_zc(sqe, sockfd, buf, nbytes, flags, zc_flags);
+    }
+    io_uring_sqe_set_flags(sqe, iflags);
+    token->arm(sqe);
+  }
+
+  /** Send a message on a socket without copying, check send_zc for the two cqes. Available since 6.1.
+   * @see io_uring_enter(2) IORING_OP_SENDMSG_ZC
+   * @param iflags IOSQE_* flags
+   */
+  void sendmsg_zc(int sockfd, const msghdr *msg, unsigned flags, multishot_token *token, uint8_t iflags = 0) noexcept {
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_sendmsg_zc(sqe, sockfd, msg, flags);
+    io_uring_sqe_set_flags(sqe, iflags);
+    token->arm(sqe);
+  }
+
   /** Wait for an event on a file descriptor asynchronously
    * @see poll(2)
    * @see io_uring_enter(2)
@@ -379,6 +521,41 @@ class io_uring_context : noncopyable {
     return make_awaitable(sqe, iflags);
   }
 
+  /** Accept connections on a socket asynchronously, one sqe for many connections
+   * Every accepted connection posts a cqe with IORING_CQE_F_MORE set, the last cqe (error or cancelled)
+   * comes without it, then the request should be re-armed. Available since 5.19.
+   * @see io_uring_enter(2) IORING_OP_ACCEPT, IORING_ACCEPT_MULTISHOT
+   * @param token results go to it, make sure it's drained before arming it again
+   * @param direct install the accepted file into the fixed file table (allocated by the kernel), a.k.a. res is
+   * a slot index instead of a fd, the table must be registered before (see io_context::fixed_files())
+   * @param iflags IOSQE_* flags
+   */
+  void multishot_accept(int fd, multishot_token *token, bool direct = false, int flags = 0,
+                        uint8_t iflags = 0) noexcept {
+    auto *sqe = io_uring_get_sqe_safe();
+    if (direct) {
+      io_uring_prep_multishot_accept_direct(sqe, fd, nullptr, nullptr, flags);
+    } else {
+      io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr, flags);
+    }
+    io_uring_sqe_set_flags(sqe, iflags);
+    token->arm(sqe);
+  }
+
+  /** Stop a multishot request and give up the token
+   * The token is deleted right now if it's not armed, or it would be deleted at the last cqe
+   * (-ECANCELED usually), results come after this are dropped.
+   */
+  void cancel_multishot(multishot_token *token) noexcept {
+    if (token->detach()) {
+      delete token;
+      return;
+    }
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_cancel64(sqe, reinterpret_cast<__u64>(token->user_data()), 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+  }
+
   /** Initiate a connection on a socket asynchronously
    * @see connect(2)
    * @see io_uring_enter(2) IORING_OP_CONNECT
@@ -602,17 +779,17 @@ class io_uring_context : noncopyable {
  private:
   io_awaitable make_awaitable(io_uring_sqe *sqe, uint8_t iflags) noexcept {
     io_uring_sqe_set_flags(sqe, iflags);
-    return io_awaitable(sqe);
+    return io_awaitable(sqe, this);
   }
 
   io_awaitable_flag make_awaitable_flag(io_uring_sqe *sqe, uint8_t iflags) noexcept {
     io_uring_sqe_set_flags(sqe, iflags);
-    return io_awaitable_flag(sqe);
+    return io_awaitable_flag(sqe, this);
   }
 
   io_awaitable_res_flag make_awaitable_res_flag(io_uring_sqe *sqe, uint8_t iflags) noexcept {
     io_uring_sqe_set_flags(sqe, iflags);
-    return io_awaitable_res_flag(sqe);
+    return io_awaitable_res_flag(sqe, this);
   }
 
  public:
@@ -687,6 +864,16 @@ class io_uring_context : noncopyable {
   int unregister_buffers() noexcept { return io_uring_unregister_buffers(&ring); }
 
  public:
+  /** Check if the running kernel supports an opcode, probed once at construction.
+   * @param op IORING_OP_*
+   */
+  [[nodiscard]] bool opcode_supported(int op) const noexcept {
+    return op >= 0 && static_cast<size_t>(op) < supported_ops_.size() && supported_ops_.test(op);
+  }
+
+  /** Check if io_uring_enter takes a timeout (IORING_FEAT_EXT_ARG, 5.11+). */
+  [[nodiscard]] bool ext_arg_supported() const noexcept { return ring.features & IORING_FEAT_EXT_ARG; }
+
   /** Return internal io_uring_context handle */
   [[nodiscard]] ::io_uring &get_ring_handle() noexcept { return ring; }
   [[nodiscard]] int ring_fd() const noexcept { return ring.ring_fd; }
@@ -695,9 +882,145 @@ class io_uring_context : noncopyable {
   ::io_uring ring{};
 
  private:
+  /// SQPOLL mode: sqes go to the SQ thread by the tail bump only (io_uring_submit won't enter while it's awake),
+  /// and the CQ is polled SQPOLL_CQ_POLLS times (on multi-core hosts) before blocking in io_uring_enter, since the SQ thread may complete
+  /// the requests just submitted in a few microseconds. If the SQ thread is asleep, the wakeup goes with the
+  /// blocking enter (IORING_ENTER_SQ_WAKEUP), a.k.a. one syscall at most per round.
+  void sqpoll_wait(int min_c, __kernel_timespec *ts) {
+    bool asleep =
+        io_uring_sq_ready(&ring) != 0 && (IO_URING_READ_ONCE(*ring.sq.kflags) & IORING_SQ_NEED_WAKEUP) != 0;
+    if (asleep) {
+      ++submit_stats_.sq_wakeups;
+    } else {
+      io_uring_submit(&ring);
+      if (min_c == 0 || poll_cq(static_cast<unsigned>(min_c))) {
+        ++submit_stats_.enters_avoided;
+        return;
+      }
+    }
+    ++submit_stats_.enters;
+    enter(min_c, ts);
+  }
+
+  bool poll_cq(unsigned min_c) noexcept {
+    for (unsigned i = 0; i < cq_polls_; i++) {
+      if (io_uring_cq_ready(&ring) >= min_c) {
+        return true;
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#elif defined(__aarch64__)
+      asm volatile("yield");
+#endif
+    }
+    return io_uring_cq_ready(&ring) >= min_c;
+  }
+
+  void enter(int min_c, __kernel_timespec *ts) {
+    if (ts == nullptr || min_c == 0) {
+      io_uring_submit_and_wait(&ring, min_c);
+      return;
+    }
+    io_uring_cqe *cqe;
+    // -ETIME when timed out, nothing to do with it.
+    io_uring_submit_and_wait_timeout(&ring, &cqe, min_c, ts, nullptr);
+  }
+
+  void probe_opcodes() noexcept {
+    auto probe = io_uring_get_probe_ring(&ring);
+    if (probe == nullptr) {
+      // kernel older than 5.6, keep all unsupported, callers would go the old way.
+      return;
+    }
+    for (int op = 0; op <= probe->last_op && static_cast<size_t>(op) < supported_ops_.size(); op++) {
+      supported_ops_.set(op, io_uring_opcode_supported(probe, op));
+    }
+    io_uring_free_probe(probe);
+  }
+
+  static void dispatch(void *data, int res, __u32 flags) {
+    auto coro = static_cast<io_token *>(data);
+    // support the timeout enter, if we have kernel support EXT_ARG
+    // then this would be unnecessary
+    // msg_ring wakeups carry nothing, the loop would check its todo list after this.
+    if (coro != nullptr && coro != reinterpret_cast<void *>(LIBURING_UDATA_TIMEOUT) &&
+        coro != reinterpret_cast<void *>(UDATA_MSG_RING_WAKEUP)) {
+      if (multishot_token::is_multishot(coro)) {
+        multishot_token::from_user_data(coro)->resolve(res, flags);
+      } else {
+        coro->resolve(res, flags);
+      }
+    }
+    //      } else {
+    //        LOG_TRACE("a detached event {} returns a result: res: {}, flag: {}", (void *)coro, cqe->res,
+    //        cqe->flags);
+    //      }
+  }
+
+  void handle_completions_inline() {
+    io_uring_cqe *cqe;
+    unsigned head;
+    bool first = true;
+    io_uring_for_each_cqe(&ring, head, cqe) {
+      // NOTICE: io_uring_get_sqe_safe may advance the head (and reset cqe_count) in a continuation.
+      ++cqe_count;
+      ++stats_.cqes;
+      stats_.rounds += first;
+      first = false;
+      dispatch(io_uring_cqe_get_data(cqe), cqe->res, cqe->flags);
+    }
+    io_uring_cq_advance(&ring, cqe_count);
+    cqe_count = 0;
+  }
+
+  void handle_completions_batched() {
+    struct completion {
+      void *data;
+      int res;
+      __u32 flags;
+    };
+    io_uring_cqe *cqes[CQE_REAP_BATCH];
+    completion batch[CQE_REAP_BATCH];
+    unsigned n;
+    bool first = true;
+    do {
+      // it also flushes the overflow backlog of the kernel, if any.
+      n = io_uring_peek_batch_cqe(&ring, cqes, CQE_REAP_BATCH);
+      for (unsigned i = 0; i < n; i++) {
+        batch[i] = {io_uring_cqe_get_data(cqes[i]), cqes[i]->res, cqes[i]->flags};
+      }
+      io_uring_cq_advance(&ring, n);
+      if (n != 0) {
+        stats_.rounds += first;
+        stats_.cqes += n;
+        first = false;
+      }
+      for (unsigned i = 0; i < n; i++) {
+        dispatch(batch[i].data, batch[i].res, batch[i].flags);
+      }
+      // a full batch, there may be more.
+    } while (n == CQE_REAP_BATCH || (n != 0 && io_uring_cq_has_overflow(&ring)));
+  }
+
   unsigned cqe_count = 0;
+  bool batched_reaping_{false};
+  reap_stats_t stats_{};
+  submit_stats_t submit_stats_{};
+  // with a single cpu the SQ thread can't run while we poll, block at once then.
+  unsigned cq_polls_{std::thread::hardware_concurrency() > 1 ? SQPOLL_CQ_POLLS : 0};
+  std::bitset<256> supported_ops_{};
 };
 
+inline bool io_token::cancel() noexcept {
+  if (!in_flight() || ring == nullptr) {
+    return false;
+  }
+  auto *sqe = ring->io_uring_get_sqe_safe();
+  io_uring_prep_cancel(sqe, reinterpret_cast<__u64>(this), 0);
+  // detached, a.k.a. nobody waits for the result of the cancel itself.
+  io_uring_sqe_set_data(sqe, nullptr);
+  return true;
+}
 }  // namespace coring::detail
 
 #endif  // CORING_IO_URING_CONTEXT_HPP
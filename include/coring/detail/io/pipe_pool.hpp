@@ -0,0 +1,78 @@
+// pipe_pool.hpp
+// Created by PanJunzhong on 2022/5/22.
+//
+// Idle pipes kept per ring for splicing (file -> pipe -> socket), a.k.a. no pipe2/close pair and no
+// F_SETPIPE_SZ per transfer.
+
+#ifndef CORING_PIPE_POOL_HPP
+#define CORING_PIPE_POOL_HPP
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <system_error>
+#include "coring/coring_config.hpp"
+#include "coring/detail/noncopyable.hpp"
+
+namespace coring::detail {
+struct spliced_pipe {
+  int rd{-1};
+  int wr{-1};
+  // bytes it holds at most, which is what a single splice can move.
+  size_t capacity{0};
+};
+
+/// A pipe goes back to the pool only if it's empty, the one with leftover (e.g. the transfer failed halfway)
+/// is closed, otherwise the next user would send the stale bytes.
+/// Not thread-safe, use it on the thread of the ring.
+class pipe_pool : noncopyable {
+ public:
+  explicit pipe_pool(size_t max_idle = PIPE_POOL_MAX_IDLE, int pipe_size = SPLICE_PIPE_SIZE)
+      : max_idle_{max_idle}, pipe_size_{pipe_size} {}
+
+  ~pipe_pool() {
+    for (auto &p : idle_) {
+      close_pipe(p);
+    }
+  }
+
+  /// \return an idle pipe or a new one, throw std::system_error if pipe2 fails.
+  spliced_pipe acquire() {
+    if (!idle_.empty()) {
+      auto p = idle_.back();
+      idle_.pop_back();
+      return p;
+    }
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0) {
+      throw std::system_error(std::error_code{errno, std::system_category()});
+    }
+    // NOTICE: it fails (EPERM) above /proc/sys/fs/pipe-max-size or the per-user pipe pages for unprivileged
+    // users, the pipe keeps the default size then.
+    ::fcntl(fds[1], F_SETPIPE_SZ, pipe_size_);
+    auto size = ::fcntl(fds[1], F_GETPIPE_SZ);
+    return spliced_pipe{fds[0], fds[1], size > 0 ? static_cast<size_t>(size) : 4096};
+  }
+
+  /// \param empty false if the pipe may hold some bytes, it's closed then.
+  void release(spliced_pipe p, bool empty) {
+    if (empty && idle_.size() < max_idle_) {
+      idle_.push_back(p);
+    } else {
+      close_pipe(p);
+    }
+  }
+
+  [[nodiscard]] size_t idle() const { return idle_.size(); }
+
+ private:
+  static void close_pipe(spliced_pipe &p) {
+    ::close(p.rd);
+    ::close(p.wr);
+  }
+
+  size_t max_idle_;
+  int pipe_size_;
+  std::vector<spliced_pipe> idle_{};
+};
+}  // namespace coring::detail
+#endif  // CORING_PIPE_POOL_HPP
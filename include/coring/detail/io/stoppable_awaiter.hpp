@@ -0,0 +1,90 @@
+// stoppable_awaiter.hpp
+// Created by PanJunzhong on 2022/5/29.
+//
+// A io request that goes with a std::stop_token: request_stop() submits a IORING_OP_ASYNC_CANCEL for it,
+// from any thread, and it completes with -ECANCELED (or with its own result if it's done first).
+
+#ifndef CORING_STOPPABLE_AWAITER_HPP
+#define CORING_STOPPABLE_AWAITER_HPP
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <optional>
+#include <stop_token>
+#include <utility>
+#include "coring/io_context.hpp"
+#include "coring/detail/io/io_awaitable.hpp"
+
+namespace coring::detail {
+/// Owns the io_awaitable (so the token address is stable after co_await) and a stop_callback while it's in flight.
+/// A stop requested on the thread of the context cancels it at once, on other threads the cancel goes through
+/// io_context::post_cancel, a.k.a. the ring is only touched by its own thread.
+template <typename Awaitable>
+requires std::derived_from<Awaitable, io_awaitable_base>
+class stoppable_awaiter : noncopyable {
+  struct request_cancel {
+    stoppable_awaiter *self;
+    void operator()() const noexcept { self->on_stop(); }
+  };
+
+ public:
+  stoppable_awaiter(Awaitable op, std::stop_token stop) noexcept : op_{std::move(op)}, stop_{std::move(stop)} {}
+
+  stoppable_awaiter(stoppable_awaiter &&rhs) noexcept : op_{std::move(rhs.op_)}, stop_{std::move(rhs.stop_)} {}
+
+  bool await_ready() noexcept { return op_.await_ready(); }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    op_.await_suspend(h);
+    if (stop_.stop_possible()) {
+      ctx_ = coro::get_io_context();
+      // it's invoked right here if a stop is requested already.
+      on_stop_.emplace(stop_, request_cancel{this});
+    }
+  }
+
+  /// \return the result of the request, -ECANCELED if it's stopped in time.
+  decltype(auto) await_resume() {
+    // waits for a callback running on another thread.
+    on_stop_.reset();
+    if (queued_.load(std::memory_order_acquire)) {
+      ctx_->withdraw_cancel(&op_);
+    }
+    return op_.await_resume();
+  }
+
+ private:
+  void on_stop() noexcept {
+    if (ctx_->on_this_thread()) {
+      op_.cancel();
+      return;
+    }
+    queued_.store(true, std::memory_order_release);
+    ctx_->post_cancel(&op_);
+  }
+
+  Awaitable op_;
+  std::stop_token stop_;
+  io_context *ctx_{nullptr};
+  std::atomic<bool> queued_{false};
+  std::optional<std::stop_callback<request_cancel>> on_stop_{};
+};
+}  // namespace coring::detail
+
+namespace coring {
+/// Make a io request stoppable, parallel to with_timeout but no timer and no coroutine frame.
+/// <p>Usage:</p>
+/// @code
+///  std::stop_source src;
+///  int n = co_await with_stop(ctx.read(fd, buf, sz, 0), src.get_token());
+///  if (n == -ECANCELED) { ... }  // src.request_stop() on any thread
+/// @endcode
+/// \param op a io_awaitable not co_awaited yet, e.g. ctx.read(...).
+/// \return an awaiter of the same result as op.
+template <typename Awaitable>
+requires std::derived_from<Awaitable, detail::io_awaitable_base>
+detail::stoppable_awaiter<Awaitable> with_stop(Awaitable op, std::stop_token stop) {
+  return {std::move(op), std::move(stop)};
+}
+}  // namespace coring
+#endif  // CORING_STOPPABLE_AWAITER_HPP
@@ -0,0 +1,69 @@
+
+#ifndef CORING_MPSC_QUEUE_HPP
+#define CORING_MPSC_QUEUE_HPP
+#include <atomic>
+#include <utility>
+#include "coring/detail/noncopyable.hpp"
+
+namespace coring::detail {
+/// A multi-producer single-consumer queue, lock-free on both sides.
+/// Producers push onto a linked stack (a CAS each), the consumer takes the whole
+/// stack with one exchange and reverses it, so items are consumed in FIFO order and in batch.
+/// This is all we need for a todo list of an event loop: the loop swaps the list out once per round.
+/// push() tells whether the queue was empty, so only the first producer of a batch need to wake the
+/// consumer up, a.k.a. wakeups are coalesced.
+template <typename T>
+class mpsc_queue : noncopyable {
+  struct node {
+    T value;
+    node *next;
+  };
+
+ public:
+  mpsc_queue() = default;
+  ~mpsc_queue() {
+    consume_all([](T &&) {});
+  }
+
+  /// thread-safe
+  /// \return true if the queue was empty before this push.
+  bool push(T &&val) {
+    auto n = new node{std::move(val), nullptr};
+    auto old = head_.load(std::memory_order_relaxed);
+    do {
+      n->next = old;
+    } while (!head_.compare_exchange_weak(old, n, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return old == nullptr;
+  }
+
+  /// only the consumer can call this.
+  /// \param f called with every item in FIFO order.
+  /// \return how many items are consumed.
+  template <typename Func>
+  size_t consume_all(Func &&f) {
+    node *list = head_.exchange(nullptr, std::memory_order_acq_rel);
+    node *rev = nullptr;
+    while (list != nullptr) {
+      auto next = list->next;
+      list->next = rev;
+      rev = list;
+      list = next;
+    }
+    size_t cnt = 0;
+    while (rev != nullptr) {
+      auto next = rev->next;
+      f(std::move(rev->value));
+      delete rev;
+      rev = next;
+      cnt++;
+    }
+    return cnt;
+  }
+
+  [[nodiscard]] bool empty() const { return head_.load(std::memory_order_acquire) == nullptr; }
+
+ private:
+  std::atomic<node *> head_{nullptr};
+};
+}  // namespace coring::detail
+#endif  // CORING_MPSC_QUEUE_HPP
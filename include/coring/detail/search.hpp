@@ -0,0 +1,199 @@
+// search.hpp
+// Created by PanJunzhong on 2022/5/23.
+//
+// Delimiter search for buffers (a byte, CRLF and the CRLFCRLF ending a http header), SSE2 and AVX2 kernels
+// chosen by cpuid at startup, and a scalar one (on memchr) for other CPUs.
+// All return nullptr if there's no match in [b, e).
+
+#ifndef CORING_DETAIL_SEARCH_HPP
+#define CORING_DETAIL_SEARCH_HPP
+#include <cstring>
+#include "coring/coring_config.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(CORING_NO_SIMD_SEARCH)
+#define CORING_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace coring::detail::search {
+namespace scalar {
+inline const char *find_byte(const char *b, const char *e, char c) {
+  return b < e ? static_cast<const char *>(::memchr(b, c, e - b)) : nullptr;
+}
+
+inline const char *find_crlf(const char *b, const char *e) {
+  while (e - b >= 2) {
+    // a '\r' at the last byte can't start one.
+    auto cr = static_cast<const char *>(::memchr(b, '\r', e - b - 1));
+    if (cr == nullptr) {
+      return nullptr;
+    }
+    if (cr[1] == '\n') {
+      return cr;
+    }
+    b = cr + 1;
+  }
+  return nullptr;
+}
+
+inline const char *find_2crlf(const char *b, const char *e) {
+  while (e - b >= 4) {
+    auto cr = static_cast<const char *>(::memchr(b, '\r', e - b - 3));
+    if (cr == nullptr) {
+      return nullptr;
+    }
+    if (::memcmp(cr, "\r\n\r\n", 4) == 0) {
+      return cr;
+    }
+    b = cr + 1;
+  }
+  return nullptr;
+}
+}  // namespace scalar
+
+#ifdef CORING_SEARCH_X86
+// CRLF: a '\r' is rare in a header except at the line ends, so the '\r's of a block are the candidates and
+// the byte after is checked one by one, it beats comparing two shifted loads on the short lines.
+// CRLFCRLF: a match at i is a CRLF at i of the block and at i of the block loaded 2 bytes later, a.k.a. 4 loads,
+// so a block of 16 (32) starts needs 19 (35) bytes, the tail is left to the narrower kernel.
+namespace sse2 {
+inline const char *find_byte(const char *b, const char *e, char c) {
+  const auto needle = _mm_set1_epi8(c);
+  for (; e - b >= 16; b += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    auto m = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    if (m != 0) {
+      return b + __builtin_ctz(m);
+    }
+  }
+  return scalar::find_byte(b, e, c);
+}
+
+inline const char *find_crlf(const char *b, const char *e) {
+  const auto cr = _mm_set1_epi8('\r');
+  for (; e - b >= 16; b += 16) {
+    auto m = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)), cr)));
+    for (; m != 0; m &= m - 1) {
+      auto p = b + __builtin_ctz(m);
+      if (p + 1 < e && p[1] == '\n') {
+        return p;
+      }
+    }
+  }
+  return scalar::find_crlf(b, e);
+}
+
+inline const char *find_2crlf(const char *b, const char *e) {
+  const auto cr = _mm_set1_epi8('\r');
+  const auto lf = _mm_set1_epi8('\n');
+  for (; e - b >= 19; b += 16) {
+    auto v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    auto v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 1));
+    auto v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 2));
+    auto v3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 3));
+    auto crlf0 = _mm_and_si128(_mm_cmpeq_epi8(v0, cr), _mm_cmpeq_epi8(v1, lf));
+    auto crlf2 = _mm_and_si128(_mm_cmpeq_epi8(v2, cr), _mm_cmpeq_epi8(v3, lf));
+    auto m = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(crlf0, crlf2)));
+    if (m != 0) {
+      return b + __builtin_ctz(m);
+    }
+  }
+  return scalar::find_2crlf(b, e);
+}
+}  // namespace sse2
+
+// NOTICE: built with the target attribute instead of -mavx2, a.k.a. the binary still runs on CPUs without it,
+// don't call them unless cpuid says so.
+namespace avx2 {
+__attribute__((target("avx2"))) inline const char *find_byte(const char *b, const char *e, char c) {
+  const auto needle = _mm256_set1_epi8(c);
+  for (; e - b >= 32; b += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    auto m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    if (m != 0) {
+      return b + __builtin_ctz(m);
+    }
+  }
+  return sse2::find_byte(b, e, c);
+}
+
+__attribute__((target("avx2"))) inline const char *find_crlf(const char *b, const char *e) {
+  const auto cr = _mm256_set1_epi8('\r');
+  for (; e - b >= 32; b += 32) {
+    auto m = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)), cr)));
+    for (; m != 0; m &= m - 1) {
+      auto p = b + __builtin_ctz(m);
+      if (p + 1 < e && p[1] == '\n') {
+        return p;
+      }
+    }
+  }
+  return sse2::find_crlf(b, e);
+}
+
+__attribute__((target("avx2"))) inline const char *find_2crlf(const char *b, const char *e) {
+  const auto cr = _mm256_set1_epi8('\r');
+  const auto lf = _mm256_set1_epi8('\n');
+  for (; e - b >= 35; b += 32) {
+    auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 1));
+    auto v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 2));
+    auto v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 3));
+    auto crlf0 = _mm256_and_si256(_mm256_cmpeq_epi8(v0, cr), _mm256_cmpeq_epi8(v1, lf));
+    auto crlf2 = _mm256_and_si256(_mm256_cmpeq_epi8(v2, cr), _mm256_cmpeq_epi8(v3, lf));
+    auto m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(crlf0, crlf2)));
+    if (m != 0) {
+      return b + __builtin_ctz(m);
+    }
+  }
+  return sse2::find_2crlf(b, e);
+}
+}  // namespace avx2
+#endif
+
+struct kernels {
+  const char *(*find_byte)(const char *, const char *, char);
+  const char *(*find_crlf)(const char *, const char *);
+  const char *(*find_2crlf)(const char *, const char *);
+  const char *name;
+};
+
+inline constexpr kernels scalar_kernels{scalar::find_byte, scalar::find_crlf, scalar::find_2crlf, "scalar"};
+#ifdef CORING_SEARCH_X86
+inline constexpr kernels sse2_kernels{sse2::find_byte, sse2::find_crlf, sse2::find_2crlf, "sse2"};
+inline constexpr kernels avx2_kernels{avx2::find_byte, avx2::find_crlf, avx2::find_2crlf, "avx2"};
+#endif
+
+inline kernels pick_kernels() {
+#ifdef CORING_SEARCH_X86
+  // it may run in a static initializer, before libgcc fills the cpu model.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return avx2_kernels;
+  }
+#if defined(__SSE2__)
+  return sse2_kernels;
+#else
+  return __builtin_cpu_supports("sse2") ? sse2_kernels : scalar_kernels;
+#endif
+#else
+  return scalar_kernels;
+#endif
+}
+
+/// Picked at the first call, a function static instead of a global so that searching in a static initializer
+/// of another TU won't see the null kernels.
+inline const kernels &active_kernels() {
+  static const kernels k = pick_kernels();
+  return k;
+}
+
+inline const char *find_byte(const char *b, const char *e, char c) { return active_kernels().find_byte(b, e, c); }
+
+inline const char *find_crlf(const char *b, const char *e) { return active_kernels().find_crlf(b, e); }
+
+inline const char *find_2crlf(const char *b, const char *e) { return active_kernels().find_2crlf(b, e); }
+}  // namespace coring::detail::search
+#endif  // CORING_DETAIL_SEARCH_HPP
@@ -0,0 +1,104 @@
+// size_class_freelist.hpp
+// Created by PanJunzhong on 2022/5/27.
+//
+// Per-thread freelists of power of 2 size classes, the storage of pooled coroutine frames (frame_allocator.hpp)
+// and of flex_buffer (buffer_storage.hpp), a.k.a. an allocation is a pop and a free is a push, not a malloc/free.
+
+#ifndef CORING_SIZE_CLASS_FREELIST_HPP
+#define CORING_SIZE_CLASS_FREELIST_HPP
+#include <cstddef>
+#include <new>
+
+namespace coring::detail {
+/// Size classes are MinClass, MinClass * 2 ... MaxClass, larger blocks go to operator new directly.
+/// At most IdlePerClass free blocks are kept per class, the rest go back to operator delete.
+/// A block freed on another thread joins the freelists of that thread, nothing is shared between threads.
+/// Every instantiation has its own thread_local lists.
+template <size_t MinClass, size_t MaxClass, unsigned IdlePerClass>
+struct size_class_freelist {
+  static constexpr size_t MIN_CLASS = MinClass;
+  static constexpr size_t MAX_CLASS = MaxClass;
+  static constexpr size_t CLASSES = [] {
+    size_t n = 1;
+    for (auto c = MIN_CLASS; c < MAX_CLASS; c <<= 1) {
+      n++;
+    }
+    return n;
+  }();
+
+  struct lists {
+    // the next block is kept in the first bytes of a free one.
+    void *head[CLASSES];
+    unsigned count[CLASSES];
+    // the thread is exiting, frees go to operator delete.
+    bool closed;
+  };
+
+  /// Frees the idle blocks at thread exit.
+  struct reaper {
+    ~reaper() {
+      auto &l = tl_lists;
+      for (size_t c = 0; c < CLASSES; c++) {
+        while (l.head[c] != nullptr) {
+          auto next = *static_cast<void **>(l.head[c]);
+          ::operator delete(l.head[c]);
+          l.head[c] = next;
+        }
+        l.count[c] = 0;
+      }
+      l.closed = true;
+    }
+  };
+
+  // trivially destructible, so that a block freed after the thread_locals (e.g. by a global) still finds it.
+  static inline thread_local lists tl_lists{};
+  static inline thread_local reaper tl_reaper{};
+
+  static size_t class_of(size_t n) {
+    size_t c = 0;
+    for (auto size = MIN_CLASS; size < n; size <<= 1) {
+      c++;
+    }
+    return c;
+  }
+
+  static size_t size_of(size_t c) { return MIN_CLASS << c; }
+
+  /// \return the free blocks of the class kept by this thread.
+  static unsigned idle(size_t c) { return tl_lists.count[c]; }
+
+  static void *allocate(size_t n) {
+    if (n > MAX_CLASS) {
+      return ::operator new(n);
+    }
+    // odr-use it, so it's constructed (and destroyed at exit) on this thread.
+    (void)&tl_reaper;
+    auto &l = tl_lists;
+    auto c = class_of(n);
+    if (auto p = l.head[c]; p != nullptr) {
+      l.head[c] = *static_cast<void **>(p);
+      l.count[c]--;
+      return p;
+    }
+    return ::operator new(size_of(c));
+  }
+
+  /// \param n the same as allocated.
+  static void deallocate(void *p, size_t n) noexcept {
+    auto &l = tl_lists;
+    if (n > MAX_CLASS || l.closed) {
+      ::operator delete(p);
+      return;
+    }
+    auto c = class_of(n);
+    if (l.count[c] >= IdlePerClass) {
+      ::operator delete(p);
+      return;
+    }
+    *static_cast<void **>(p) = l.head[c];
+    l.head[c] = p;
+    l.count[c]++;
+  }
+};
+}  // namespace coring::detail
+#endif  // CORING_SIZE_CLASS_FREELIST_HPP
@@ -19,6 +19,7 @@
 #include <random>
 #include <vector>
 #include <mutex>
+#include <functional>
 #include <iostream>
 #include <memory_resource>
 #include <list>
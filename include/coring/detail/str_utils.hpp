@@ -1,4 +1,5 @@
 #include <string>
+#include <algorithm>
 #ifndef CORING_STR_UTILS
 #define CORING_STR_UTILS
 namespace coring::detail {
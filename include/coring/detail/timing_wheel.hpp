@@ -0,0 +1,285 @@
+// timing_wheel.hpp
+// Created by PanJunzhong on 2022/5/16.
+//
+// A hierarchical timing wheel for timer, O(1) insertion and erasing.
+// The algorithm is the one in William Ahern's timeout.c (MIT license, http://25thandclement.com/~william/projects/timeout.c.html):
+// there are 8 wheels of 64 slots, a timeout is put to the wheel chosen by how far it's from now,
+// a.k.a. wheel n holds timeouts that are 64^n to 64^(n+1) ticks away, every wheel has a 64-bit bitmap telling
+// which slots are not empty, so finding the next expiration and moving the wheels forward are just a few ctz.
+// When time goes by, the slots passed are moved down to lower wheels (or to the expired list).
+// One tick is one key unit, for coring::timer it's a microsecond, so 8 wheels cover 2^48us (about 8.9 years),
+// farther ones are clamped to the last wheel and re-placed every time it's visited.
+// Nodes are recycled in a free list, so there is no allocation in the steady state.
+
+#ifndef CORING_TIMING_WHEEL_HPP
+#define CORING_TIMING_WHEEL_HPP
+#include <bit>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "coring/detail/noncopyable.hpp"
+
+namespace coring::detail {
+template <typename ValueType, typename KeyType = long>
+class timing_wheel : noncopyable {
+  static_assert(std::is_default_constructible_v<ValueType>);
+  static constexpr int WHEEL_BIT = 6;
+  static constexpr int WHEEL_LEN = 1 << WHEEL_BIT;
+  static constexpr int WHEEL_NUM = 8;
+  static constexpr uint64_t WHEEL_MASK = WHEEL_LEN - 1;
+  static constexpr uint64_t WHEEL_MAX = WHEEL_LEN - 1;
+  static constexpr uint64_t TIMEOUT_MAX = (uint64_t{1} << (WHEEL_BIT * WHEEL_NUM)) - 1;
+
+  struct list;
+
+ public:
+  /// An intrusive node, also used as the handle of a timeout.
+  struct node {
+    node *prev{nullptr};
+    node *next{nullptr};
+    list *owner{nullptr};
+    KeyType expires{};
+    ValueType value{};
+  };
+  typedef node *handle_t;
+
+ private:
+  struct list {
+    node *head{nullptr};
+    node *tail{nullptr};
+    [[nodiscard]] bool empty() const { return head == nullptr; }
+    void push_back(node *n) {
+      n->owner = this;
+      n->next = nullptr;
+      n->prev = tail;
+      if (tail != nullptr) {
+        tail->next = n;
+      } else {
+        head = n;
+      }
+      tail = n;
+    }
+    void remove(node *n) {
+      (n->prev != nullptr ? n->prev->next : head) = n->next;
+      (n->next != nullptr ? n->next->prev : tail) = n->prev;
+      n->prev = n->next = nullptr;
+      n->owner = nullptr;
+    }
+    /// move all nodes of `other` to the back of this one.
+    void splice(list &other) {
+      for (auto n = other.head; n != nullptr; n = n->next) {
+        n->owner = this;
+      }
+      if (other.empty()) {
+        return;
+      }
+      if (empty()) {
+        head = other.head;
+      } else {
+        tail->next = other.head;
+        other.head->prev = tail;
+      }
+      tail = other.tail;
+      other.head = other.tail = nullptr;
+    }
+  };
+
+ public:
+  /// \param now the current time, all keys later put in are absolute time points after it.
+  explicit timing_wheel(KeyType now = 0) : curtime_{now} {}
+
+  ~timing_wheel() {
+    for (auto &w : wheel_) {
+      for (auto &l : w) {
+        free_list(l);
+      }
+    }
+    free_list(expired_);
+    free_list(firing_);
+    while (free_ != nullptr) {
+      auto next = free_->next;
+      delete free_;
+      free_ = next;
+    }
+  }
+
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+  [[nodiscard]] size_t size() const { return size_; }
+
+  [[nodiscard]] KeyType current_time() const { return curtime_; }
+
+  /// \return true if the node is still waiting to be popped, false if it's popped/erased (sitting in the free list).
+  [[nodiscard]] static bool linked(handle_t n) { return n->owner != nullptr; }
+
+  /// O(1)
+  /// \return a handle for erase(), valid until the timeout is popped or erased.
+  template <typename K, typename V>
+  handle_t emplace(K &&key, V &&val) {
+    auto n = allocate();
+    n->expires = static_cast<KeyType>(key);
+    n->value = std::forward<V>(val);
+    schedule(n);
+    size_++;
+    return n;
+  }
+
+  /// O(1), make sure the handle is still valid.
+  void erase(handle_t n) {
+    remove(n);
+    release(n);
+    size_--;
+  }
+
+  /// Move the wheels to `now`, timeouts that <= now go to the expired list.
+  void update(KeyType now) {
+    if (now <= curtime_) {
+      return;
+    }
+    auto elapsed = static_cast<uint64_t>(now - curtime_);
+    list todo{};
+    for (int wheel = 0; wheel < WHEEL_NUM; wheel++) {
+      uint64_t pending;
+      auto shift = wheel * WHEEL_BIT;
+      if ((elapsed >> shift) > WHEEL_MAX) {
+        pending = ~uint64_t{0};
+      } else {
+        auto elapsed_slots = static_cast<int>(WHEEL_MASK & (elapsed >> shift));
+        auto oslot = static_cast<int>(WHEEL_MASK & (static_cast<uint64_t>(curtime_) >> shift));
+        auto nslot = static_cast<int>(WHEEL_MASK & (static_cast<uint64_t>(now) >> shift));
+        auto span = (uint64_t{1} << elapsed_slots) - 1;
+        pending = std::rotl(span, oslot);
+        pending |= std::rotr(std::rotl(span, nslot), elapsed_slots);
+        pending |= uint64_t{1} << nslot;
+      }
+      while (pending & pending_[wheel]) {
+        auto slot = std::countr_zero(pending & pending_[wheel]);
+        todo.splice(wheel_[wheel][slot]);
+        pending_[wheel] &= ~(uint64_t{1} << slot);
+      }
+      if (!(pending & 0x1)) {
+        // didn't wrap around the end of this wheel
+        break;
+      }
+      // if we're continuing, the next wheel must tick at least once
+      elapsed = std::max(elapsed, uint64_t{WHEEL_LEN} << shift);
+    }
+    curtime_ = now;
+    while (!todo.empty()) {
+      auto n = todo.head;
+      todo.remove(n);
+      schedule(n);
+    }
+  }
+
+  /// It may be earlier than the real one (never later), a.k.a. you may wake up and find nothing to pop,
+  /// call it after verified !empty().
+  /// \return the absolute time point of the next expiration.
+  [[nodiscard]] KeyType next_expiration() const {
+    if (!expired_.empty()) {
+      return curtime_;
+    }
+    uint64_t timeout = ~uint64_t{0};
+    uint64_t relmask = 0;
+    for (int wheel = 0; wheel < WHEEL_NUM; wheel++) {
+      if (pending_[wheel]) {
+        auto shift = wheel * WHEEL_BIT;
+        auto slot = static_cast<int>(WHEEL_MASK & (static_cast<uint64_t>(curtime_) >> shift));
+        // +1 to higher order wheels as those timeouts are one rotation in the future
+        uint64_t t = static_cast<uint64_t>(std::countr_zero(std::rotr(pending_[wheel], slot)) + !!wheel) << shift;
+        // reduce by how much lower wheels have progressed
+        t -= relmask & static_cast<uint64_t>(curtime_);
+        timeout = std::min(t, timeout);
+      }
+      relmask <<= WHEEL_BIT;
+      relmask |= WHEEL_MASK;
+    }
+    return curtime_ + static_cast<KeyType>(timeout);
+  }
+
+  /// Same as skiplist_map::do_less_eq_then_pop.
+  /// NOTICE: f is free to insert new timeouts or erase others, those expire at once would be handled next time.
+  /// \return how many are popped.
+  size_t do_less_eq_then_pop(const KeyType &key, const std::function<void(ValueType &)> &f) {
+    update(key);
+    firing_.splice(expired_);
+    size_t cnt = 0;
+    while (!firing_.empty()) {
+      auto n = firing_.head;
+      firing_.remove(n);
+      size_--;
+      cnt++;
+      f(n->value);
+      release(n);
+    }
+    return cnt;
+  }
+
+  std::vector<ValueType> pop_less_eq(const KeyType &key) {
+    std::vector<ValueType> res;
+    do_less_eq_then_pop(key, [&res](ValueType &v) { res.emplace_back(std::move(v)); });
+    return res;
+  }
+
+ private:
+  void schedule(node *n) {
+    if (n->expires > curtime_) {
+      auto rem = std::min(static_cast<uint64_t>(n->expires - curtime_), TIMEOUT_MAX);
+      auto wheel = static_cast<int>((std::bit_width(rem) - 1) / WHEEL_BIT);
+      auto slot = static_cast<int>(WHEEL_MASK & ((static_cast<uint64_t>(n->expires) >> (wheel * WHEEL_BIT)) - !!wheel));
+      wheel_[wheel][slot].push_back(n);
+      pending_[wheel] |= uint64_t{1} << slot;
+    } else {
+      expired_.push_back(n);
+    }
+  }
+
+  void remove(node *n) {
+    auto owner = n->owner;
+    owner->remove(n);
+    auto first = &wheel_[0][0];
+    if (owner >= first && owner < first + WHEEL_NUM * WHEEL_LEN && owner->empty()) {
+      auto index = owner - first;
+      pending_[index / WHEEL_LEN] &= ~(uint64_t{1} << (index % WHEEL_LEN));
+    }
+  }
+
+  node *allocate() {
+    if (free_ == nullptr) {
+      return new node{};
+    }
+    auto n = free_;
+    free_ = n->next;
+    n->next = nullptr;
+    return n;
+  }
+
+  void release(node *n) {
+    n->value = ValueType{};
+    n->owner = nullptr;
+    n->prev = nullptr;
+    n->next = free_;
+    free_ = n;
+  }
+
+  static void free_list(list &l) {
+    while (l.head != nullptr) {
+      auto next = l.head->next;
+      delete l.head;
+      l.head = next;
+    }
+    l.tail = nullptr;
+  }
+
+  list wheel_[WHEEL_NUM][WHEEL_LEN]{};
+  uint64_t pending_[WHEEL_NUM]{};
+  list expired_{};
+  // popped out but not handled yet, the callback may erase them.
+  list firing_{};
+  KeyType curtime_;
+  size_t size_{0};
+  node *free_{nullptr};
+};
+}  // namespace coring::detail
+#endif  // CORING_TIMING_WHEEL_HPP
@@ -2,6 +2,7 @@
 #ifndef CORING_FILE_HPP
 #define CORING_FILE_HPP
 #include "file_descriptor.hpp"
+#include "registered_buffer_arena.hpp"
 namespace coring {
 
 class bad_file : public std::system_error {
@@ -110,9 +111,14 @@ class file_base : public file_descriptor {
   /// \param dst
   /// \param nbytes expected count, short read may occurs, one most common case is a file bigger than 2GB
   ///        other case when kernel buffer is insufficient would occurs.
+  /// READ_FIXED is used if dst is inside the registered_buffer_arena of the context.
   /// \return bytes really read from file
   inline detail::io_awaitable read(char *dst, size_t nbytes, off_t off = 0) {
-    return coro::get_io_context_ref().read(fd_, (void *)dst, (unsigned)nbytes, off);
+    auto &ctx = coro::get_io_context_ref();
+    if (auto index = detail::registered_index(ctx, dst, nbytes); index >= 0) {
+      return ctx.read_fixed(fd_, dst, (unsigned)nbytes, off, index);
+    }
+    return ctx.read(fd_, (void *)dst, (unsigned)nbytes, off);
   }
 
   /// I think this would be a class provides low-level interfaces,
@@ -123,9 +129,14 @@ class file_base : public file_descriptor {
   /// \param dst
   /// \param nbytes expected count, short read may occurs, one most common case is a file bigger than 2GB
   ///        other case when kernel buffer is insufficient would occurs.
+  /// WRITE_FIXED is used if src is inside the registered_buffer_arena of the context.
   /// \return bytes really written to file
   inline detail::io_awaitable write(const char *src, size_t nbytes, off_t off = 0) {
-    return coro::get_io_context_ref().write(fd_, (void *)src, (unsigned)nbytes, off);
+    auto &ctx = coro::get_io_context_ref();
+    if (auto index = detail::registered_index(ctx, src, nbytes); index >= 0) {
+      return ctx.write_fixed(fd_, src, (unsigned)nbytes, off, index);
+    }
+    return ctx.write(fd_, (void *)src, (unsigned)nbytes, off);
   }
 
  private:
@@ -4,7 +4,9 @@
 #define CORING_IO_CONTEXT_HPP
 #include <functional>
 #include <thread>
+#include <atomic>
 #include <latch>
+#include <mutex>
 #include <sys/poll.h>
 #include <sys/signalfd.h>
 
@@ -14,8 +16,11 @@
 #include "coring/coring_config.hpp"
 
 #include "coring/detail/io/io_uring_context.hpp"
+#include "coring/detail/io/fixed_file_table.hpp"
+#include "coring/detail/io/pipe_pool.hpp"
 #include "coring/detail/noncopyable.hpp"
 #include "coring/detail/debug.hpp"
+#include "coring/detail/mpsc_queue.hpp"
 
 #include "coring/task.hpp"
 #include "coring/async_task.hpp"
@@ -32,6 +37,7 @@
 
 namespace coring {
 class io_context;
+class registered_buffer_arena;
 struct coro {
   inline static auto get_io_context() {
     auto ptr = reinterpret_cast<coring::io_context *>(io_context_thread_local);
@@ -111,20 +117,27 @@ class io_context : public coring::detail::io_uring_context {
   }
 
   /// stupid name, only for dev channel...
+  /// Create a context share the same async backend (SQPOLL thread and io-wq) with `bro`.
   /// \return a io_context isntance.
   static inline io_context dup_from_big_brother(io_context *bro, int entries = 64) {
-    auto fl = bro->ring.flags;
-    if (fl & IORING_SETUP_SQPOLL) {
-      // You can only get real entries from ring->sz or the para when you init one ,we just pass in one...
-      // RVO should work here.
-      return io_context{entries, fl | IORING_SETUP_ATTACH_WQ, static_cast<uint32_t>(bro->ring_fd())};
-    } else {
-      return io_context{entries, fl};
-    }
+    // You can only get real entries from ring->sz or the para when you init one ,we just pass in one...
+    // RVO should work here.
+    // ATTACH_WQ is harmless without SQPOLL, the kernel only checks if wq_fd is a ring fd.
+    auto fl = bro->ring.flags & ~IORING_SETUP_ATTACH_WQ;
+    return io_context{entries, fl | IORING_SETUP_ATTACH_WQ, static_cast<uint32_t>(bro->ring_fd())};
   }
 
   io_context(int entries, io_uring_params p) : detail::io_uring_context{entries, p} { create_eventfd(); }
 
+  /// A SQPOLL ring: sqes are submitted by the tail bump only, and the loop polls the CQ a while before it blocks,
+  /// so a busy loop makes (almost) no io_uring_enter at all, check submit_stats().
+  /// NOTICE: the SQ thread burns a cpu until it idles `idle_ms`, pin it away from the loop thread.
+  /// \param cpu pin the SQ thread to it, -1 to let it float.
+  /// \return a io_context instance.
+  static inline io_context with_sqpoll(int entries = 64, int cpu = -1, unsigned idle_ms = SQPOLL_IDLE_MS) {
+    return io_context{entries, sqpoll_params(cpu, idle_ms)};
+  }
+
   io_context(int entries, io_uring_params *p) : detail::io_uring_context{entries, p} { create_eventfd(); }
 
   void register_signals(signal_set &s, __sighandler_t func = nullptr) {
@@ -136,7 +149,11 @@ class io_context : public coring::detail::io_uring_context {
   coring::async_run init_signalfd(__sighandler_t func) {
     struct signalfd_siginfo siginfo {};
     do {
-      co_await read(internal_signal_fd_, &siginfo, sizeof(siginfo), 0, 0);
+      int n = co_await read(internal_signal_fd_, &siginfo, sizeof(siginfo), 0, 0);
+      if (n != sizeof(siginfo)) {
+        // e.g. cancelled by shutdown().
+        continue;
+      }
       if (func != nullptr) {
         func(siginfo.ssi_signo);
       }
@@ -146,19 +163,22 @@ class io_context : public coring::detail::io_uring_context {
     } while (!stopped_);
   }
   /// this coroutine should start (and be suspended) at io_context start
+  /// It keeps reading while shutdown() drains as well, so posts from other threads still wake us up then.
   coring::async_run init_eventfd() {
+    eventfd_reading_ = true;
     uint64_t msg;
-    while (!stopped_) {
+    while (!stopped_ || draining_) {
       // Don't use LOG_DEBUG_RAW since it's not thread safe (only use when testing)
       // LOG_DEBUG_RAW("co_await the eventfd!, must be inside of the loop");
-      co_await read(internal_event_fd_, &msg, 8, 0, 0);
+      int n = co_await read(internal_event_fd_, &msg, 8, 0, 0);
       // TODO: I don't know if this is a good solution..
       // since strict-ordering memory model are available on current x86 CPUs.
       // But if volatile restrict program to read from memory, it would be costly.
-      if (msg >= EV_STOP_MSG) {
+      if (n == 8 && msg >= EV_STOP_MSG) {
         stopped_ = true;
       }
     }
+    eventfd_reading_ = false;
   }
 
   /// TODO: I just find a other approaches to implement user level timer...
@@ -171,6 +191,8 @@ class io_context : public coring::detail::io_uring_context {
   /// The other approach is just use wait_cqe_with_timeout/io_uring_enter,
   /// just like what we did with epoll before.
   /// @see: https://github.com/axboe/liburing/issues/4
+  /// UPDATE: done, with IORING_FEAT_EXT_ARG the loop passes the next expiration to io_uring_enter (check do_run),
+  /// this is only the fallback for older kernels.
   /// \return
   async_run init_timeout_callback() {
     while (!stopped_) {
@@ -195,24 +217,57 @@ class io_context : public coring::detail::io_uring_context {
   }
 
   void do_todo_list() {
-    std::vector<my_todo_t> local_copy{};
-    local_copy.swap(todo_list_);
-    for (auto &t : local_copy) {
+    // a.k.a. swap the list out, the next post() after this would wake us up again.
+    auto n = todo_list_.consume_all([this](my_todo_t &&t) {
       // user should not pass any long running task in here.
       // that is to say, a task with co_await inside instead of
       // some blocking task...
       execute(std::move(t));
+    });
+    todo_count_.fetch_sub(n, std::memory_order_relaxed);
+  }
+
+  /// Ring the doorbell of this context from another thread.
+  /// If the caller is running another loop, a IORING_OP_MSG_RING sqe is queued to its ring, it would be submitted
+  /// together with other sqes of that loop, so no syscall here. Otherwise fallback to a write to the eventfd.
+  void remote_wakeup() {
+    auto src = coro::get_io_context();
+    if (src != nullptr && src != this && src->opcode_supported(IORING_OP_MSG_RING)) {
+      src->send_msg_ring_wakeup(*this);
+    } else {
+      wakeup();
+    }
+  }
+
+  /// run on the sender loop.
+  async_run send_msg_ring_wakeup(io_context &target) {
+    auto res = co_await msg_ring(target.ring_fd(), 0, UDATA_MSG_RING_WAKEUP);
+    if (res < 0) {
+      // e.g. -EOVERFLOW, never lose a wakeup.
+      target.wakeup();
     }
   }
 
-  // TODO: I won't deal with cancellation now...(2)
   // Cancellation is complicated, what boost.asio do is
   // just provide interface to cancel all async operations on specific socket (by closing it).
-  // Maybe std::stop_source would be enough for most cases.
-  // If need to close a socket/file, please make sure you use the IORING_OP_CLOSE with io_uring
-  // for revoking all previous posts.
+  // Here a std::stop_token goes with a request (check coring::with_stop), a stop requested on another thread
+  // queues the token, and the loop submits the IORING_OP_ASYNC_CANCEL for it.
   // @see: https://patchwork.kernel.org/project/linux-fsdevel/patch/20191213183632.19441-9-axboe@kernel.dk/
-  void do_cancel_list() { throw std::invalid_argument("not available in this channel"); }
+  void do_cancel_list() {
+    if (!has_cancels_.load(std::memory_order_acquire)) {
+      return;
+    }
+    std::vector<detail::io_token *> list;
+    {
+      std::lock_guard lk{cancel_mutex_};
+      list.swap(to_cancel_list_);
+      has_cancels_.store(false, std::memory_order_relaxed);
+    }
+    // they are alive, a token is withdrawn (on this thread) before it's gone.
+    for (auto token : list) {
+      token->cancel();
+    }
+  }
 
  public:
   inline executor_t as_executor() { return this; }
@@ -229,17 +284,51 @@ class io_context : public coring::detail::io_uring_context {
     my_scope_.spawn(std::forward<AWAITABLE>(awaitable));
   }
 
-  /// Just don't use this, check io_context::spawn(...).
-  void schedule(my_todo_t &&awaitable) { todo_list_.emplace_back(std::move(awaitable)); }
+  /// Queue a task to be started by the loop, it's safe to call this from any thread.
+  /// Only the first post after the loop drains its queue would wake the loop up (coalesced),
+  /// using IORING_OP_MSG_RING when posted from another loop or the eventfd otherwise.
+  /// Inside of the loop thread, check io_context::spawn(...).
+  void post(my_todo_t &&t) {
+    todo_count_.fetch_add(1, std::memory_order_relaxed);
+    if (todo_list_.push(std::move(t)) && !on_this_thread()) {
+      remote_wakeup();
+    }
+  }
+
+  /// Cancel a request submitted to this context, it's safe to call this from any thread.
+  /// The owner must withdraw_cancel() it before the token is gone, if it's not cancelled yet.
+  void post_cancel(detail::io_token *token) {
+    if (on_this_thread()) {
+      token->cancel();
+      return;
+    }
+    {
+      std::lock_guard lk{cancel_mutex_};
+      to_cancel_list_.push_back(token);
+      has_cancels_.store(true, std::memory_order_release);
+    }
+    remote_wakeup();
+  }
+
+  /// On the loop thread, the token is going away.
+  void withdraw_cancel(detail::io_token *token) {
+    std::lock_guard lk{cancel_mutex_};
+    std::erase(to_cancel_list_, token);
+  }
+
+  /// Same as post(...), kept for old code.
+  void schedule(my_todo_t &&awaitable) { post(std::move(awaitable)); }
 
   void schedule(std::vector<my_todo_t> &task_list) {
-    if (todo_list_.empty()) {
-      std::swap(todo_list_, task_list);
-    } else {
-      std::move(task_list.begin(), task_list.end(), std::back_inserter(todo_list_));
-      task_list.clear();
+    for (auto &t : task_list) {
+      post(std::move(t));
     }
+    task_list.clear();
   }
+
+  /// A rough load indicator for placement, a.k.a. how many tasks are queued or alive.
+  /// It's only a snapshot when called from other threads.
+  size_t load() { return todo_count_.load(std::memory_order_relaxed) + my_scope_.pending(); }
   /// set timeout
   /// \tparam AWAITABLE
   /// \param awaitable
@@ -248,13 +337,47 @@ class io_context : public coring::detail::io_uring_context {
 
  public:
   // on the same thread...
-  void register_timeout(std::coroutine_handle<> cont, std::chrono::microseconds exp) {
+  /// \return a handle for cancel_timeout().
+  timer::handle_t register_timeout(std::coroutine_handle<> cont, std::chrono::microseconds exp) {
     // TODO: if no this wrapper, the async_run would be exposed to user.
     // Actually this two argument is all POD...no move required.
-    timer_.add_event(cont, exp);
-    timer_event_.set();
+    auto h = timer_.add_event(cont, exp);
+    if (!timer_in_enter_) {
+      timer_event_.set();
+    }
+    return h;
   }
 
+  /// Wait for the timers in io_uring_enter (the default with IORING_FEAT_EXT_ARG) or with a IORING_OP_TIMEOUT per
+  /// expiration (init_timeout_callback, the fallback for older kernels), a.k.a. the fallback can be tested on a new
+  /// kernel too. Set it before the first run(), turning it on without EXT_ARG is ignored.
+  void set_timer_in_enter(bool on) { timer_in_enter_ = on && ext_arg_supported(); }
+
+  [[nodiscard]] bool timer_in_enter() const { return timer_in_enter_; }
+
+  /// The continuation would not be resumed by the timer anymore, it's the caller's duty to resume it (or not).
+  /// \return false if it has fired already.
+  bool cancel_timeout(timer::handle_t h) {
+    // no need to wake the timer callback up, it would find nothing at worst.
+    return timer_.cancel(h);
+  }
+
+  /// The cached monotonic time of this loop, refreshed once per wakeup, use it instead of reading the clock
+  /// on a hot path. Only meaningful on the loop thread.
+  [[nodiscard]] std::chrono::microseconds loop_time() const { return std::chrono::microseconds(timer_.now()); }
+
+  /// The sparse fixed file table of this ring, registered at the first use.
+  /// Sockets go in by socket::use_fixed_file(), or by acceptor/connect_to if the auto install is on.
+  detail::fixed_file_table &fixed_files() { return fixed_files_; }
+
+  /// The registered buffer arena of this ring (one at most, io_uring has a single buffer table), nullptr if none.
+  /// Set by the arena, file_base/connection ops check it to go with read_fixed/write_fixed.
+  registered_buffer_arena *buffer_arena() { return buffer_arena_; }
+  void set_buffer_arena(registered_buffer_arena *arena) { buffer_arena_ = arena; }
+
+  /// Reusable pipes of this ring for splicing, check coring::send_file.
+  detail::pipe_pool &pipes() { return pipes_; }
+
   void wakeup() { notify(EV_WAKEUP_MSG); }
 
   inline void submit() { wakeup(); }
@@ -282,16 +405,22 @@ class io_context : public coring::detail::io_uring_context {
       ::close(internal_signal_fd_);
     }
     // have to co_await async_scope
-    // FIXME: dangerous here.. we lost the scope, memory leaking
-    // we can maintain a list of task/coroutine, then destroy then all, but it's not simple to impl.
-    // another better solution would be using a timeout for all operation, but it damage the performance for
-    // creating lots of linked timeout to the hrtimer in kernel.
-    // a better one should be done using the cancellation, we can just keep a list of user_data (maybe using a
-    // std::unordered_set) and cancel all of them.
+    // FIXME: the tasks still alive are leaked here, call shutdown() first to cancel and drain them.
     [a = this]() -> async_run { co_await a->my_scope_.join(); }();
   }
 
  private:
+  /// Spawned tasks alive or posted ones not started yet.
+  bool has_work() { return my_scope_.pending() != 0 || todo_count_.load(std::memory_order_relaxed) != 0; }
+
+  /// Same as wait_for_completions_then_handle, but refresh the loop time in between,
+  /// so that all completions of one round see the same (cached) now.
+  void wait_then_handle(int min_c, __kernel_timespec *ts = nullptr) {
+    wait_for_completions(min_c, ts);
+    timer_.update_now();
+    handle_completions();
+  }
+
   /// the best practice might be using a eventfd in io_uring_context
   /// or manage your timing event using a rb-tree timing wheel etc. to
   /// use IORING_OP_TIMEOUT like timerfd in epoll?
@@ -299,20 +428,44 @@ class io_context : public coring::detail::io_uring_context {
   void do_run() {
     // bind thread.
     stopped_ = false;
-    init_eventfd();
+    // the context may be created long before, don't let the first timeouts base on that.
+    timer_.update_now();
+    // it may be still reading since the last run (stopped on this thread).
+    if (!eventfd_reading_) {
+      init_eventfd();
+    }
     // do scheduled tasks
     if (internal_signal_fd_ != -1) {
       init_signalfd(signal_func_);
     }
     do_todo_list();
+    if (timer_in_enter_) {
+      while (!stopped_) {
+        // the earliest deadline goes with io_uring_enter, no timeout sqe at all.
+        if (!todo_list_.empty()) {
+          wait_then_handle(0);
+        } else if (timer_.has_more_timeouts()) {
+          auto ts = timer_.get_next_expiration();
+          wait_then_handle(1, &ts);
+        } else {
+          wait_then_handle(1);
+        }
+        timer_.handle_events();
+        do_todo_list();
+        do_cancel_list();
+      }
+      return;
+    }
     init_timeout_callback();
     while (!stopped_) {
       // the coroutine would be resumed inside io_token.resolve() method
       // blocking syscall. Call io_uring_submit_and_wait.
-      wait_for_completions_then_handle();
+      // don't block if someone has queued tasks when we are running the list.
+      wait_then_handle(todo_list_.empty() ? 1 : 0);
       do_todo_list();
+      do_cancel_list();
     }
-    // TODO: handle stop event, deal with async_scope (issue cancellations then call join) exiting
+    // NOTICE: spawned tasks are left as they are, check shutdown().
   }
 
  public:
@@ -329,6 +482,58 @@ class io_context : public coring::detail::io_uring_context {
     coro::provide(nullptr);
   }
 
+  /// Graceful exit, call it on the thread of the context after run() returns (by stop() or SIGINT):
+  /// a IORING_OP_ASYNC_CANCEL with IORING_ASYNC_CANCEL_ANY cancels every request in flight (accept streams end,
+  /// recv/send etc. complete with -ECANCELED), then completions, timers and posted tasks are pumped until all the
+  /// spawned tasks finish, or the deadline passes.
+  /// NOTICE: it's done once, requests submitted after that (e.g. the rest of a response) are not cancelled but
+  /// waited for, check shutting_down() before starting new work. The kernel needs 5.19 for CANCEL_ANY, on older
+  /// ones only the waiting is done.
+  /// <p>Usage:</p>
+  /// @code
+  ///  ctx.run();
+  ///  if (!ctx.shutdown(5s)) { ... }  // some are still alive
+  /// @endcode
+  /// \param timeout relative to now.
+  /// \return true if all the spawned and posted tasks are finished, the rest are left suspended otherwise.
+  template <typename Rep, typename Period>
+  bool shutdown(std::chrono::duration<Rep, Period> timeout) {
+    coro::provide(this);
+    draining_ = true;
+    timer_.update_now();
+    auto deadline = loop_time() + std::chrono::duration_cast<std::chrono::microseconds>(timeout);
+    auto *sqe = io_uring_get_sqe_safe();
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data(sqe, nullptr);
+    if (!eventfd_reading_) {
+      init_eventfd();
+    }
+    do_todo_list();
+    while (has_work() && loop_time() < deadline) {
+      // wake up at the deadline, or at the next timer if it's earlier.
+      auto ts = make_timespec(deadline - loop_time());
+      if (timer_.has_more_timeouts()) {
+        auto next = timer_.get_next_expiration();
+        if (next.tv_sec < ts.tv_sec || (next.tv_sec == ts.tv_sec && next.tv_nsec < ts.tv_nsec)) {
+          ts = next;
+        }
+      }
+      wait_then_handle(todo_list_.empty() ? 1 : 0, &ts);
+      timer_.handle_events();
+      do_todo_list();
+      do_cancel_list();
+    }
+    draining_ = false;
+    coro::provide(nullptr);
+    return !has_work();
+  }
+
+  // the IORING_OP_SHUTDOWN of a socket.
+  using detail::io_uring_context::shutdown;
+
+  /// shutdown() is in progress, e.g. don't go on with the next keep-alive request.
+  [[nodiscard]] bool shutting_down() const { return draining_; }
+
   void stop() {
     // LOG_TRACE("server done!");
     if (reinterpret_cast<coring::io_context *>(coro::get_io_context()) == this) {
@@ -345,22 +550,41 @@ class io_context : public coring::detail::io_uring_context {
   // a event fd for many uses
   int internal_event_fd_{-1};
   int internal_signal_fd_{-1};
-  std::mutex mutex_;
   // no volatile for all changes are made in the same thread
   // not using stop_token for better performance.
   // TODO: should we use a atomic and stop using eventfd msg to demux ?
   bool stopped_{true};
-  // for co_spawn
-  std::vector<my_todo_t> todo_list_{};
-  // TODO: I won't deal with cancellation now...(1)
-  // for cancelling
-  std::vector<io_cancel_token> to_cancel_list_{};
+  // in shutdown().
+  bool draining_{false};
+  bool eventfd_reading_{false};
+  // for co_spawn, post from any thread.
+  detail::mpsc_queue<my_todo_t> todo_list_{};
+  std::atomic<size_t> todo_count_{0};
+  // requests to cancel, queued by post_cancel from other threads.
+  std::mutex cancel_mutex_;
+  std::vector<detail::io_token *> to_cancel_list_{};
+  std::atomic<bool> has_cancels_{false};
   coring::async_scope my_scope_{};
   coring::timer timer_{};
+  // wait for the next expiration in io_uring_enter (EXT_ARG) instead of a IORING_OP_TIMEOUT per wakeup.
+  bool timer_in_enter_{ext_arg_supported()};
   coring::single_consumer_async_auto_reset_event timer_event_;
+  detail::fixed_file_table fixed_files_{&ring};
+  registered_buffer_arena *buffer_arena_{nullptr};
+  detail::pipe_pool pipes_{};
   __sighandler_t signal_func_{nullptr};
 };
 inline void co_spawn(task<> &&t) { coro::get_io_context_ref().spawn(std::move(t)); }
+
+/// Hand a task over to another context (maybe running on another thread), e.g. fanning out accepted
+/// connections to worker rings. Started right now if `ctx` is the current one.
+inline void dispatch_to(io_context &ctx, task<> &&t) {
+  if (ctx.on_this_thread()) {
+    ctx.spawn(std::move(t));
+  } else {
+    ctx.post(std::move(t));
+  }
+}
 }  // namespace coring
 
 #endif  // CORING_IO_CONTEXT_HPP
@@ -0,0 +1,167 @@
+// registered_buffer_arena.hpp
+// Created by PanJunzhong on 2022/5/19.
+//
+// A big region registered to the ring (io_uring_register_buffers) and sliced into registered_buffers.
+// The kernel pins the pages once at registration, then read_fixed/write_fixed on them skip the
+// get_user_pages/put_page per I/O, which is the main cost of bulk (file serving) I/O besides the copy.
+
+#ifndef CORING_REGISTERED_BUFFER_ARENA_HPP
+#define CORING_REGISTERED_BUFFER_ARENA_HPP
+#include <sys/mman.h>
+#include <vector>
+#include <system_error>
+#include "coring/buffer.hpp"
+#include "coring/io_context.hpp"
+
+namespace coring {
+class registered_buffer_arena;
+
+/// A fixed_buffer on a slice of the arena, it carries the index of the registered buffer (for read_fixed etc.),
+/// and gives the slice back when it's destroyed. Keep it from outliving the arena.
+class registered_buffer : public fixed_buffer {
+  friend class registered_buffer_arena;
+  registered_buffer(registered_buffer_arena *arena, char *base, size_t len, int index)
+      : fixed_buffer{base, len}, arena_{arena}, index_{index} {}
+
+ public:
+  registered_buffer(registered_buffer &&rhs) noexcept
+      : fixed_buffer{std::move(rhs)}, arena_{rhs.arena_}, index_{rhs.index_} {
+    rhs.arena_ = nullptr;
+  }
+  ~registered_buffer() override;
+
+  [[nodiscard]] int buf_index() const { return index_; }
+
+ private:
+  registered_buffer_arena *arena_;
+  int index_;
+};
+
+/// Memory comes from hugepages (MAP_HUGETLB) if the system has some reserved, or regular pages with
+/// MADV_HUGEPAGE. Every slice is a registered iovec, so a buffer index is just the slice index.
+/// The ring has only one buffer table, a.k.a. one arena per io_context, it's published by
+/// io_context::buffer_arena() so that file_base and tcp connections pick read_fixed/write_fixed automatically
+/// when the memory they get is inside it.
+/// Not thread-safe, use it on the thread of the context.
+/// <p>Usage:</p>
+/// @code
+///  registered_buffer_arena arena{&ctx, 64 * 1024, 256};
+///  auto buf = arena.allocate();
+///  co_await file.read(buf.back(), buf.writable(), off); // IORING_OP_READ_FIXED
+/// @endcode
+class registered_buffer_arena : noncopyable {
+  static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+  // a registered iovec can't be larger than 1GB.
+  static constexpr size_t SLICE_MAX = 1024 * 1024 * 1024;
+
+ public:
+  /// Map and register the region, throw std::system_error if either fails.
+  /// \param ctx the ring to register with, it must outlive the arena.
+  /// \param slice_size bytes of a slice, <= 1GB
+  /// \param slices how many slices, <= 16384 (IORING_MAX_REG_BUFFERS)
+  registered_buffer_arena(io_context *ctx, size_t slice_size, unsigned slices)
+      : ctx_{ctx}, slice_size_{slice_size}, slices_{slices} {
+    if (slice_size == 0 || slice_size > SLICE_MAX || slices == 0) {
+      throw std::invalid_argument("bad slice size or count for registered_buffer_arena");
+    }
+    if (ctx_->buffer_arena() != nullptr) {
+      throw std::runtime_error("the io_context has a registered buffer arena already");
+    }
+    map_region();
+    std::vector<iovec> iovs(slices);
+    for (unsigned i = 0; i < slices; i++) {
+      iovs[i] = {base_ + i * slice_size_, slice_size_};
+    }
+    auto ret = ::io_uring_register_buffers(&ctx_->get_ring_handle(), iovs.data(), slices);
+    if (ret < 0) {
+      ::munmap(base_, mapped_);
+      throw std::system_error(std::error_code{-ret, std::system_category()});
+    }
+    free_.reserve(slices);
+    for (int i = static_cast<int>(slices) - 1; i >= 0; i--) {
+      free_.push_back(i);
+    }
+    ctx_->set_buffer_arena(this);
+  }
+
+  ~registered_buffer_arena() {
+    ctx_->set_buffer_arena(nullptr);
+    ::io_uring_unregister_buffers(&ctx_->get_ring_handle());
+    ::munmap(base_, mapped_);
+  }
+
+  /// O(1)
+  /// \return a free slice, throw std::runtime_error if all are taken.
+  registered_buffer allocate() {
+    if (free_.empty()) {
+      throw std::runtime_error("registered_buffer_arena exhausted");
+    }
+    auto index = free_.back();
+    free_.pop_back();
+    return registered_buffer{this, base_ + index * slice_size_, slice_size_, index};
+  }
+
+  /// \return the index of the slice holding [p, p + n), -1 if it's not (entirely) inside one.
+  [[nodiscard]] int index_of(const void *p, size_t n) const {
+    auto c = static_cast<const char *>(p);
+    if (c < base_ || c >= base_ + slice_size_ * slices_) {
+      return -1;
+    }
+    auto index = static_cast<size_t>(c - base_) / slice_size_;
+    return c + n <= base_ + (index + 1) * slice_size_ ? static_cast<int>(index) : -1;
+  }
+
+  [[nodiscard]] size_t available() const { return free_.size(); }
+
+  [[nodiscard]] size_t slice_size() const { return slice_size_; }
+
+  /// \return true if the region is MAP_HUGETLB backed.
+  [[nodiscard]] bool huge_pages() const { return huge_; }
+
+ private:
+  friend class registered_buffer;
+
+  void release(int index) { free_.push_back(index); }
+
+  void map_region() {
+    auto want = slice_size_ * slices_;
+    mapped_ = (want + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      huge_ = true;
+    } else {
+      // no hugepages reserved (vm.nr_hugepages), ask THP for them instead.
+      mapped_ = want;
+      p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        throw std::system_error(std::error_code{errno, std::system_category()});
+      }
+      ::madvise(p, mapped_, MADV_HUGEPAGE);
+    }
+    base_ = static_cast<char *>(p);
+  }
+
+  io_context *ctx_;
+  size_t slice_size_;
+  unsigned slices_;
+  char *base_{nullptr};
+  size_t mapped_{0};
+  bool huge_{false};
+  std::vector<int> free_{};
+};
+
+inline registered_buffer::~registered_buffer() {
+  if (arena_ != nullptr) {
+    arena_->release(index_);
+  }
+}
+
+namespace detail {
+/// \return the registered buffer index of [p, p + n) on this ring, -1 if it's not registered memory.
+inline int registered_index(io_context &ctx, const void *p, size_t n) {
+  auto arena = ctx.buffer_arena();
+  return arena != nullptr ? arena->index_of(p, n) : -1;
+}
+}  // namespace detail
+}  // namespace coring
+#endif  // CORING_REGISTERED_BUFFER_ARENA_HPP
@@ -0,0 +1,167 @@
+// ring_buffer.hpp
+// Created by PanJunzhong on 2022/5/25.
+//
+// A buffer on a ring of pages mapped twice in a row (memfd + two MAP_FIXED mmaps), so the readable and the
+// writable parts are always contiguous even when they wrap, and make_room never moves or zero-fills bytes
+// unless the ring is really full. For long-lived (pipelined) connections.
+
+#ifndef CORING_RING_BUFFER_HPP
+#define CORING_RING_BUFFER_HPP
+#include <sys/mman.h>
+#include <unistd.h>
+#include <system_error>
+#include <utility>
+#include "coring/buffer.hpp"
+
+namespace coring {
+namespace detail {
+/// [data(), data() + size()) and [data() + size(), data() + 2 * size()) are the same pages.
+class mirrored_region : noncopyable {
+ public:
+  /// \param len rounded up to pages, throw std::system_error if memfd_create or mmap fails.
+  explicit mirrored_region(size_t len) {
+    auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    len_ = len == 0 ? page : (len + page - 1) / page * page;
+    int fd = ::memfd_create("coring_ring_buffer", MFD_CLOEXEC);
+    if (fd < 0) {
+      throw std::system_error(std::error_code{errno, std::system_category()});
+    }
+    // reserve the address range of both halves first, then put the file on them.
+    void *p = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(len_)) == 0) {
+      p = ::mmap(nullptr, 2 * len_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p != MAP_FAILED) {
+      base_ = static_cast<char *>(p);
+      if (::mmap(base_, len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+          ::mmap(base_ + len_, len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        p = MAP_FAILED;
+      }
+    }
+    auto err = errno;
+    // the mappings hold the file.
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      release();
+      throw std::system_error(std::error_code{err, std::system_category()});
+    }
+  }
+
+  mirrored_region(mirrored_region &&rhs) noexcept
+      : base_{std::exchange(rhs.base_, nullptr)}, len_{std::exchange(rhs.len_, 0)} {}
+
+  mirrored_region &operator=(mirrored_region &&rhs) noexcept {
+    std::swap(base_, rhs.base_);
+    std::swap(len_, rhs.len_);
+    return *this;
+  }
+
+  ~mirrored_region() { release(); }
+
+  [[nodiscard]] char *data() { return base_; }
+  [[nodiscard]] const char *data() const { return base_; }
+  [[nodiscard]] size_t size() const { return len_; }
+  [[nodiscard]] size_t capacity() const { return len_; }
+
+ private:
+  void release() {
+    if (base_ != nullptr) {
+      ::munmap(base_, 2 * len_);
+      base_ = nullptr;
+    }
+  }
+
+  char *base_{nullptr};
+  size_t len_{0};
+};
+}  // namespace detail
+
+/// A drop-in of flex_buffer for socket_reader/socket_writer (front/readable/has_read, back/writable/has_written,
+/// make_room, find_*). The read index stays in the first half, the write index is at most a ring ahead of it.
+/// NOTICE: the capacity is in pages, a few KBs at least, don't make one per short-lived request.
+/// <p>Usage:</p>
+/// @code
+///  ring_buffer buf{};
+///  line_reader reader{&buf, line_reader<ring_buffer>::crlf};
+///  auto n = co_await reader.read(&conn);
+/// @endcode
+class ring_buffer : public detail::buffer_base<detail::mirrored_region> {
+  typedef detail::buffer_base<detail::mirrored_region> upper_buffer_t;
+
+ public:
+  typedef char value_type;
+  explicit ring_buffer(size_t init_size = RING_BUFFER_DEFAULT_SIZE)
+      : upper_buffer_t{detail::mirrored_region{init_size}} {}
+  ~ring_buffer() override = default;
+
+  [[nodiscard]] size_t writable() const { return size() - readable(); }
+
+  void has_read(size_t len) {
+    upper_buffer_t::has_read(len);
+    wrap();
+  }
+
+  std::string pop_string(size_t len) {
+    auto ret = upper_buffer_t::pop_string(len);
+    wrap();
+    return ret;
+  }
+
+  template <typename IntType>
+  IntType pop_int() {
+    auto ret = upper_buffer_t::pop_int<IntType>();
+    wrap();
+    return ret;
+  }
+
+  /// No moving at all if the ring has `want` free bytes, or a larger ring holding the readable part.
+  void make_room(size_t want) {
+    if (writable() >= want) {
+      return;
+    }
+    detail::mirrored_region bigger{std::max(size() * 2, readable() + want)};
+    auto n = readable();
+    ::memcpy(bigger.data(), front(), n);
+    container_ = std::move(bigger);
+    index_read_ = 0;
+    index_write_ = n;
+  }
+
+  /// it won't call make_room internal
+  void emplace_back(char ch) {
+    *back() = ch;
+    has_written(1);
+  }
+
+  void push_back(char ch) {
+    make_room(1);
+    emplace_back(ch);
+  }
+
+  /// You don't need to make room.
+  void push_back(const void *src, size_t len) {
+    make_room(len);
+    ::memcpy(back(), src, len);
+    has_written(len);
+  }
+
+  // put int/string to data
+  template <typename IntType>
+  void push_back_int(IntType to_put) {
+    to_put = coring::net::host_to_network(to_put);
+    push_back(&to_put, sizeof(IntType));
+  }
+
+  void push_back_string(const std::string &str) { push_back(str.data(), str.size()); }
+
+ private:
+  // back to the first half, the bytes are the same.
+  void wrap() {
+    if (index_read_ >= size()) {
+      index_read_ -= size();
+      index_write_ -= size();
+    }
+  }
+};
+}  // namespace coring
+#endif  // CORING_RING_BUFFER_HPP
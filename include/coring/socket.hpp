@@ -17,12 +17,59 @@ namespace coring {
 // mostly 5.19 from the post... There is still a long way to go...
 class socket : public file_descriptor {
  protected:
+  // the slot in a fixed file table if it's installed, the fd is kept for sync calls (setsockopt etc.).
+  int fixed_{-1};
+  detail::fixed_file_table *table_{nullptr};
+
+  void release_fixed() {
+    if (table_ != nullptr) {
+      table_->release(fixed_);
+      table_ = nullptr;
+      fixed_ = -1;
+    }
+  }
+
  public:
   socket(int fd = -1) : file_descriptor{fd} {}  // supports for placeholder
-  socket(socket &&so) : file_descriptor{std::move(so)} {}
+  socket(socket &&so) : file_descriptor{std::move(so)}, fixed_{so.fixed_}, table_{so.table_} {
+    so.fixed_ = -1;
+    so.table_ = nullptr;
+  }
+  // the slot must be cleared before the fd is closed, or the file (connection) stays open.
+  ~socket() override { release_fixed(); }
 
   int fd() const { return fd_; }
 
+  /// Install the socket into the fixed file table of the current context, io ops on it go with
+  /// IOSQE_FIXED_FILE afterwards. Keep using the socket on that context then.
+  /// \return false if the table is full or not available, the socket just works with the fd.
+  bool use_fixed_file() {
+    if (table_ != nullptr) {
+      return true;
+    }
+    auto &table = coro::get_io_context_ref().fixed_files();
+    fixed_ = table.install(fd_);
+    if (fixed_ < 0) {
+      return false;
+    }
+    table_ = &table;
+    return true;
+  }
+
+  [[nodiscard]] bool is_fixed_file() const { return table_ != nullptr; }
+
+  /// \return the fixed slot or the fd, pass it to io_uring ops with io_flags().
+  [[nodiscard]] int io_fd() const { return table_ != nullptr ? fixed_ : fd_; }
+
+  /// \return IOSQE_FIXED_FILE if the socket is installed in a fixed file table, or 0.
+  [[nodiscard]] uint8_t io_flags() const { return table_ != nullptr ? IOSQE_FIXED_FILE : 0; }
+
+  /// Clear the fixed slot then close the fd.
+  inline detail::io_awaitable close() {
+    release_fixed();
+    return file_descriptor::close();
+  }
+
   int error() const {
     int optval;
     socklen_t optlen = static_cast<socklen_t>(sizeof optval);
@@ -75,7 +122,9 @@ class socket : public file_descriptor {
     }
   }
 
-  [[nodiscard]] detail::io_awaitable shutdown(int how) { return coro::get_io_context_ref().shutdown(fd_, how); }
+  [[nodiscard]] detail::io_awaitable shutdown(int how) {
+    return coro::get_io_context_ref().shutdown(io_fd(), how, io_flags());
+  }
 
   /// It would be better to use close instead of shutdown if the file descriptor has unique ownership
   /// in some kernel (tested in 5.17), shutdown would cause async punt, when close won't.
@@ -84,6 +133,12 @@ class socket : public file_descriptor {
   [[nodiscard]] detail::io_awaitable shutdown_write() { return shutdown(SHUT_WR); }
   [[nodiscard]] detail::io_awaitable shutdown_read() { return shutdown(SHUT_RD); }
 
+  /// Cancel all the pending requests on it (IORING_ASYNC_CANCEL_FD), they complete with -ECANCELED, the fd is kept.
+  /// \return how many are cancelled, -ENOENT if none.
+  [[nodiscard]] detail::io_awaitable cancel_pending() {
+    return coro::get_io_context_ref().cancel_fd(io_fd(), table_ != nullptr);
+  }
+
   void set_reuse_port(bool on) {
     int optval = on ? 1 : 0;
     int ret = ::setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &optval, static_cast<socklen_t>(sizeof optval));
@@ -3,34 +3,88 @@
 #define CORING_SOCKET_READER_HPP
 #include <coroutine>
 #include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
 #include "coring/coring_config.hpp"
 #include "file_descriptor.hpp"
 #include "coring/buffer.hpp"
 #include "coring/task.hpp"
 #include "coring/io_context.hpp"
 #include "coring/eof_error.hpp"
+#include "coring/detail/io/io_loop_awaiter.hpp"
+#include "coring/detail/time_utils.hpp"
 #include "socket.hpp"
 
 namespace coring {
+namespace detail {
+/// read_some/read_certain into a buffer: a recv per round until `want` bytes are readable.
+/// \tparam Some one round only, it returns the bytes read.
+template <typename Buffer, typename TcpConnection, typename Timeout, bool Some>
+class buffer_read_awaiter
+    : public io_loop_awaiter<buffer_read_awaiter<Buffer, TcpConnection, Timeout, Some>, Timeout> {
+  typedef io_loop_awaiter<buffer_read_awaiter, Timeout> base_t;
+  friend base_t;
+
+ public:
+  buffer_read_awaiter(TcpConnection *sock, Buffer *buffer, size_t want, Timeout timeout = {})
+      : base_t{timeout}, sock_{sock}, buffer_{buffer}, want_{want} {}
+
+  /// \return the bytes read for read_some (always positive), nothing for read_certain.
+  auto await_resume() {
+    this->rethrow_if_failed();
+    if constexpr (Some) {
+      return read_;
+    }
+  }
+
+ private:
+  bool ready() {
+    if constexpr (Some) {
+      buffer_->make_room(READ_BUFFER_AT_LEAST_WRITABLE);
+      return false;
+    } else {
+      if (buffer_->readable() < want_) {
+        buffer_->make_room(want_ - buffer_->readable());
+      }
+      return buffer_->readable() >= want_;
+    }
+  }
+
+  void submit() { this->arm(sock_->recv_some(buffer_->back(), buffer_->writable())); }
+
+  bool on_result(int ret) {
+    // LOG_TRACE("recv_some returns: ", ret);
+    if (ret == 0) {
+      throw coring::eof_error{};
+    }
+    if (ret < 0) {
+      throw std::system_error(std::error_code{-ret, std::system_category()});
+    }
+    buffer_->has_written(ret);
+    read_ = ret;
+    return !Some && buffer_->readable() < want_;
+  }
+
+  TcpConnection *sock_;
+  Buffer *buffer_;
+  size_t want_;
+  int read_{0};
+};
+}  // namespace detail
+
+// NOTICE: the helpers below are lazy awaiters, not coroutines: nothing is received before co_await, and the next
+// recv of a short read goes on inside the awaiter, a.k.a. `co_await read_some(&conn, &buf)` allocates nothing.
+// Don't co_await one of them twice.
 
 /// Read not certain bytes from sock, this treat EOF an error
 /// since when user call this coroutine, they expect at least 1 byte received.
 /// \param sock a socket
 /// \param buffer a buffer
-/// \return 0 if EOF, other, the bytes read from sock
+/// \return the bytes read from sock, always positive
 template <typename Buffer, typename TcpConnection>
-inline async_task<int> read_some(TcpConnection *sock, Buffer *buffer) {
-  buffer->make_room(READ_BUFFER_AT_LEAST_WRITABLE);
-  int ret = co_await sock->recv_some(buffer->back(), buffer->writable());
-  // LOG_TRACE("recv_some returns: ", ret);
-  if (ret == 0) {
-    throw coring::eof_error{};
-  }
-  if (ret < 0) {
-    throw std::system_error(std::error_code{-ret, std::system_category()});
-  }
-  buffer->has_written(ret);
-  co_return ret;
+inline auto read_some(TcpConnection *sock, Buffer *buffer) {
+  return detail::buffer_read_awaiter<Buffer, TcpConnection, detail::no_timeout, true>{sock, buffer, 1};
 }
 
 /// Read not certain bytes from sock, this treat EOF an error
@@ -40,18 +94,9 @@ inline async_task<int> read_some(TcpConnection *sock, Buffer *buffer) {
 /// \param dur a duration, relative, please use chrono_literals
 /// \return the bytes read from sock, always positive
 template <typename Buffer, typename TcpConnection, class Dur>
-inline async_task<int> read_some(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
-  buffer->make_room(READ_BUFFER_AT_LEAST_WRITABLE);
-  int ret = co_await sock->recv_some(buffer->back(), buffer->writable(), std::forward<Dur>(dur));
-  // LOG_TRACE("recv_some returns: ", ret);
-  if (ret == 0) {
-    throw coring::eof_error{};
-  }
-  if (ret < 0) {
-    throw std::system_error(std::error_code{-ret, std::system_category()});
-  }
-  buffer->has_written(ret);
-  co_return ret;
+inline auto read_some(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
+  return detail::buffer_read_awaiter<Buffer, TcpConnection, __kernel_timespec, true>{
+      sock, buffer, 1, make_timespec(std::forward<Dur>(dur))};
 }
 
 /// read certain bytes, short-reads are guaranteed not occurs except for EOF
@@ -59,16 +104,9 @@ inline async_task<int> read_some(TcpConnection *sock, Buffer *buffer, Dur &&dur)
 /// \param buffer a buffer (fixed/flex)
 /// \param nbytes certain bytes want to read into buffer, it not sufficient before EOF, error thrown
 template <typename Buffer, typename TcpConnection>
-inline async_task<> read_certain(TcpConnection *sock, Buffer *buffer, int nbytes) {
-  while (buffer->readable() < nbytes) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable());
-    if (ret == 0) {
-      throw coring::eof_error{};
-    }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
-    }
-  }
+inline auto read_certain(TcpConnection *sock, Buffer *buffer, int nbytes) {
+  return detail::buffer_read_awaiter<Buffer, TcpConnection, detail::no_timeout, false>{
+      sock, buffer, static_cast<size_t>(nbytes)};
 }
 
 /// read certain bytes, short-reads are guaranteed not occurs except for EOF with timeout
@@ -77,102 +115,188 @@ inline async_task<> read_certain(TcpConnection *sock, Buffer *buffer, int nbytes
 /// \param nbytes certain bytes want to read into buffer, it not sufficient before EOF, error thrown
 /// \param dur a duration for every separate read compensate the short-count
 template <typename Buffer, typename TcpConnection, class Dur>
-inline async_task<> read_certain(TcpConnection *sock, Buffer *buffer, int nbytes, Dur &&dur) {
-  while (buffer->readable() < nbytes) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable(), std::forward<Dur>(dur));
-    if (ret == 0) {
-      throw coring::eof_error{};
+inline auto read_certain(TcpConnection *sock, Buffer *buffer, int nbytes, Dur &&dur) {
+  return detail::buffer_read_awaiter<Buffer, TcpConnection, __kernel_timespec, false>{
+      sock, buffer, static_cast<size_t>(nbytes), make_timespec(std::forward<Dur>(dur))};
+}
+
+/// Scan lines (lf or crlf ended) out of a buffer fed by a socket. It remembers how far the buffer has been scanned,
+/// so a long line coming in many small segments is scanned once instead of from front() after every recv,
+/// and grows the buffer (make_room, doubling) up to the max line length.
+/// NOTICE: the offset is relative to front(), don't consume the buffer between a call that throws (e.g. timeout)
+/// and the retry, or reset() it first.
+/// <p>Usage:</p>
+/// @code
+///  line_reader reader{&buf, line_reader<flex_buffer>::crlf};
+///  auto n = co_await reader.read(&conn);
+///  auto line = std::string_view{buf.front(), static_cast<size_t>(n)};
+///  buf.has_read(n);
+/// @endcode
+template <typename Buffer>
+class line_reader {
+ public:
+  // the value is its length.
+  enum delimiter { lf = 1, crlf = 2 };
+
+  /// \param max_line a line (with the delimiter) longer than it is an error, a.k.a. a client sending an endless
+  /// line can't take all the memory.
+  explicit line_reader(Buffer *buffer, delimiter delim = lf, size_t max_line = LINE_READER_MAX_LINE)
+      : buffer_{buffer}, delim_{delim}, max_line_{max_line} {}
+
+  /// The awaiter of read(), it scans the buffer of the reader it holds (a pointer, or a line_reader for read_line).
+  template <typename Reader, typename TcpConnection, typename Timeout>
+  class awaiter : public detail::io_loop_awaiter<awaiter<Reader, TcpConnection, Timeout>, Timeout> {
+    typedef detail::io_loop_awaiter<awaiter, Timeout> base_t;
+    friend base_t;
+
+   public:
+    awaiter(Reader reader, TcpConnection *sock, Timeout timeout = {})
+        : base_t{timeout}, reader_{reader}, sock_{sock} {}
+
+    int await_resume() {
+      this->rethrow_if_failed();
+      return len_;
     }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
+
+   private:
+    line_reader &reader() {
+      if constexpr (std::is_pointer_v<Reader>) {
+        return *reader_;
+      } else {
+        return reader_;
+      }
+    }
+
+    bool ready() { return reader().scan(&len_); }
+
+    void submit() {
+      auto buffer = reader().buffer_;
+      this->arm(sock_->recv_some(buffer->back(), buffer->writable()));
+    }
+
+    bool on_result(int ret) {
+      if (ret == 0) {
+        throw coring::eof_error{};
+      }
+      if (ret < 0) {
+        throw std::system_error(std::error_code{-ret, std::system_category()});
+      }
+      reader().buffer_->has_written(ret);
+      return !reader().scan(&len_);
     }
+
+    Reader reader_;
+    TcpConnection *sock_;
+    int len_{0};
+  };
+
+  /// Read until a line is in the buffer, throw coring::eof_error at EOF, std::length_error if the line is too long.
+  /// \return the length of the line (with the delimiter) from front(), then you can create a `std::string_view`.
+  template <typename TcpConnection>
+  auto read(TcpConnection *sock) {
+    return awaiter<line_reader *, TcpConnection, detail::no_timeout>{this, sock};
   }
-}
 
-/// read until a line is in buffer
-/// \return the length of this line, then you can create a `std::string_view`.
-template <typename Buffer, typename TcpConnection>
-async_task<int> read_line(TcpConnection *sock, Buffer *buffer) {
-  const char *end = nullptr;
-  if (buffer->readable() > 0) {
-    end = buffer->find_eol();
+  /// \param dur a duration for every separate read.
+  template <typename TcpConnection, typename Dur>
+  auto read(TcpConnection *sock, Dur &&dur) {
+    return awaiter<line_reader *, TcpConnection, __kernel_timespec>{this, sock, make_timespec(std::forward<Dur>(dur))};
   }
-  while (end == nullptr) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable());
-    end = buffer->find_eol();
-    if (ret == 0) {
-      throw coring::eof_error{};
+
+  /// Forget the scanned part, call it if the buffer is consumed by someone else.
+  void reset() { scanned_ = 0; }
+
+  /// \return bytes from front() known to have no delimiter.
+  [[nodiscard]] size_t scanned() const { return scanned_; }
+
+ private:
+  /// \return true if a line is in (its length to `len`), or it makes room for the next recv.
+  bool scan(int *len) {
+    auto end = find();
+    if (end != nullptr) {
+      scanned_ = 0;
+      auto n = static_cast<size_t>(end - buffer_->front()) + delim_;
+      if (n > max_line_) {
+        throw std::length_error("line_reader: the line is too long");
+      }
+      *len = static_cast<int>(n);
+      return true;
     }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
+    if (buffer_->readable() >= max_line_) {
+      throw std::length_error("line_reader: the line is too long");
+    }
+    make_room();
+    return false;
+  }
+
+  const char *find() {
+    auto from = buffer_->front() + scanned_;
+    auto end = delim_ == crlf ? buffer_->find_crlf(from) : buffer_->findEOL(from);
+    if (end == nullptr) {
+      // the '\r' at the end may meet its '\n' in the next segment.
+      auto r = buffer_->readable();
+      auto keep = static_cast<size_t>(delim_) - 1;
+      scanned_ = r >= keep ? r - keep : 0;
+    }
+    return end;
+  }
+
+  void make_room() {
+    if (buffer_->writable() >= READ_BUFFER_AT_LEAST_WRITABLE) {
+      return;
+    }
+    if constexpr (std::is_base_of_v<fixed_buffer, Buffer>) {
+      // move the readable part to the head only.
+      buffer_->make_room(0);
+      if (buffer_->writable() == 0) {
+        throw std::length_error("line_reader: the line is longer than the buffer");
+      }
+    } else {
+      buffer_->make_room(std::max(std::min(buffer_->readable(), max_line_), size_t{READ_BUFFER_AT_LEAST_WRITABLE}));
     }
   }
-  co_return end - buffer->front() + 1;  // the length
+
+  Buffer *buffer_;
+  delimiter delim_;
+  size_t max_line_;
+  size_t scanned_{0};
+};
+
+/// read until a line is in buffer
+/// \return the length of this line, then you can create a `std::string_view`.
+template <typename Buffer, typename TcpConnection>
+inline auto read_line(TcpConnection *sock, Buffer *buffer) {
+  using reader = line_reader<Buffer>;
+  return typename reader::template awaiter<reader, TcpConnection, detail::no_timeout>{reader{buffer}, sock};
 }
 
 /// read until a lf line (\n) is in buffer
 /// \param dur a duration for every separate read compensate the short-count.
 /// \return the length of this line, then you can create a `std::string_view`.
 template <typename Buffer, typename TcpConnection, typename Dur>
-inline async_task<int> read_line(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
-  const char *end = nullptr;
-  if (buffer->readable() > 0) {
-    end = buffer->find_eol();
-  }
-  while (end == nullptr) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable(), std::forward<Dur>(dur));
-    end = buffer->find_eol();
-    if (ret == 0) {
-      throw coring::eof_error{};
-    }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
-    }
-  }
-  co_return end - buffer->front() + 1;  // the length
+inline auto read_line(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
+  using reader = line_reader<Buffer>;
+  return typename reader::template awaiter<reader, TcpConnection, __kernel_timespec>{
+      reader{buffer}, sock, make_timespec(std::forward<Dur>(dur))};
 }
 
 /// read until a crlf line is in buffer
 /// \return the length of this line, then you can create a `std::string_view`.
 template <typename Buffer, typename TcpConnection>
-inline async_task<int> read_crlf_line(TcpConnection *sock, Buffer *buffer) {
-  const char *end = nullptr;
-  if (buffer->readable() > 0) {
-    end = buffer->find_crlf();
-  }
-  while (end == nullptr) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable());
-    end = buffer->find_crlf();
-    if (ret == 0) {
-      throw coring::eof_error{};
-    }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
-    }
-  }
-  co_return end - buffer->front() + 2;  // the length
+inline auto read_crlf_line(TcpConnection *sock, Buffer *buffer) {
+  using reader = line_reader<Buffer>;
+  return typename reader::template awaiter<reader, TcpConnection, detail::no_timeout>{reader{buffer, reader::crlf},
+                                                                                       sock};
 }
 
 /// read until a crlf line (\r\n) is in buffer
 /// \param dur a duration for every separate read compensate the short-count.
 /// \return the length of this line, then you can create a `std::string_view`.
 template <typename Buffer, typename TcpConnection, typename Dur>
-inline async_task<int> read_crlf_line(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
-  const char *end = nullptr;
-  if (buffer->readable() > 0) {
-    end = buffer->find_crlf();
-  }
-  while (end == nullptr) {
-    int ret = co_await sock->recv_some(buffer->back(), buffer->writable(), std::forward<Dur>(dur));
-    end = buffer->find_crlf();
-    if (ret == 0) {
-      throw coring::eof_error{};
-    }
-    if (ret < 0) {
-      throw std::system_error(std::error_code{-ret, std::system_category()});
-    }
-  }
-  co_return end - buffer->front() + 1;  // the length
+inline auto read_crlf_line(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
+  using reader = line_reader<Buffer>;
+  return typename reader::template awaiter<reader, TcpConnection, __kernel_timespec>{
+      reader{buffer, reader::crlf}, sock, make_timespec(std::forward<Dur>(dur))};
 }
 
 }  // namespace coring
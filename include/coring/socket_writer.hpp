@@ -3,106 +3,280 @@
 #define CORING_SOCKET_WRITER_HPP
 #include <coroutine>
 #include <cstddef>
+#include <cstdint>
+#include <algorithm>
 #include "file_descriptor.hpp"
 #include "coring/buffer.hpp"
 #include "coring/task.hpp"
 #include "coring/io_context.hpp"
 #include "coring/buffer_pool.hpp"
+#include "coring/buffer_chain.hpp"
+#include "coring/registered_buffer_arena.hpp"
+#include "coring/detail/io_utils.hpp"
+#include "coring/detail/io/io_loop_awaiter.hpp"
+#include "coring/detail/time_utils.hpp"
 #include "socket.hpp"
 #include "eof_error.hpp"
 
 namespace coring {
+namespace detail {
+/// write_some/write_certain/write_all of a buffer: a send per round until `want` bytes are written.
+/// \tparam Some one round only, eof is not an error then.
+template <typename Buffer, typename TcpConnection, typename Timeout, bool Some>
+class buffer_write_awaiter
+    : public io_loop_awaiter<buffer_write_awaiter<Buffer, TcpConnection, Timeout, Some>, Timeout> {
+  typedef io_loop_awaiter<buffer_write_awaiter, Timeout> base_t;
+  friend base_t;
+
+ public:
+  // all readable bytes when it's co_awaited.
+  static constexpr size_t ALL = SIZE_MAX;
+
+  buffer_write_awaiter(TcpConnection *sock, Buffer *buffer, size_t want, Timeout timeout = {})
+      : base_t{timeout}, sock_{sock}, buffer_{buffer}, left_{want} {}
+
+  /// \return how many bytes are written (0 if eof) for write_some, nothing for the others.
+  auto await_resume() {
+    this->rethrow_if_failed();
+    if constexpr (Some) {
+      return written_;
+    }
+  }
+
+ private:
+  bool ready() {
+    if (left_ == ALL) {
+      left_ = buffer_->readable();
+    }
+    return left_ == 0;
+  }
+
+  void submit() { this->arm(sock_->send_some(buffer_->front(), std::min(left_, buffer_->readable()))); }
+
+  bool on_result(int n) {
+    if (n == -EINTR) {
+      return true;
+    }
+    if (n < 0) {
+      throw std::system_error(std::error_code{-n, std::system_category()});
+    }
+    if constexpr (Some) {
+      buffer_->has_read(n);
+      written_ = n;
+      return false;
+    } else {
+      if (n == 0) {
+        throw coring::eof_error{};
+      }
+      buffer_->has_read(n);
+      left_ -= n;
+      return left_ != 0;
+    }
+  }
+
+  TcpConnection *sock_;
+  Buffer *buffer_;
+  size_t left_;
+  int written_{0};
+};
+
+/// write_all of a buffer_chain: a sendmsg per round until the chain is empty.
+template <typename TcpConnection>
+class chain_write_awaiter : public io_loop_awaiter<chain_write_awaiter<TcpConnection>> {
+  typedef io_loop_awaiter<chain_write_awaiter> base_t;
+  friend base_t;
+
+ public:
+  chain_write_awaiter(TcpConnection *sock, buffer_chain *chain) : sock_{sock}, chain_{chain} {}
+
+  void await_resume() { this->rethrow_if_failed(); }
+
+ private:
+  bool ready() const noexcept { return chain_->empty(); }
+
+  void submit() {
+    msg_.msg_iov = chain_->iov();
+    msg_.msg_iovlen = chain_->iov_count();
+    this->arm(sock_->sendmsg_some(&msg_));
+  }
+
+  bool on_result(int n) {
+    if (n == 0) {
+      throw coring::eof_error{};
+    }
+    if (n < 0 && n != -EINTR) {
+      throw std::system_error(std::error_code{-n, std::system_category()});
+    }
+    if (n > 0) {
+      chain_->consume(static_cast<size_t>(n));
+    }
+    return !chain_->empty();
+  }
+
+  TcpConnection *sock_;
+  buffer_chain *chain_;
+  // the kernel reads it until the sendmsg is completed.
+  msghdr msg_{};
+};
+}  // namespace detail
+
+// NOTICE: the helpers below are lazy awaiters, not coroutines: nothing is sent before co_await, and a short
+// write goes on with another sqe inside the awaiter, a.k.a. `co_await write_all(&conn, &buf)` allocates nothing.
+// Don't co_await one of them twice.
+
 /// Write some bytes to `sock` from `buffer`, eof is not an error,
 /// I use pointer as argument is doing it by convention, only use const references
 /// and pointers.
 /// \return how many bytes are written to the socket, 0 if eof
 template <typename Buffer, typename TcpConnection>
-inline async_task<int> write_some(TcpConnection *sock, Buffer *buffer) {
-  auto n = co_await sock->send_some(buffer->front(), buffer->readable());
-  if (n < 0 && n != -EINTR) {
-    throw std::system_error(std::error_code{-n, std::system_category()});
-  }
-  buffer->has_read(n);
-  co_return n;
+inline auto write_some(TcpConnection *sock, Buffer *buffer) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, detail::no_timeout, true>;
+  return awaiter{sock, buffer, awaiter::ALL};
 }
 
 /// Write some bytes to `sock` from `buffer`, eof is not an error
 /// \return how many bytes are written to the socket, 0 if eof
 template <typename Buffer, typename TcpConnection, class Dur>
-inline async_task<int> write_some(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
-  auto n = co_await sock->send_some(buffer->front(), buffer->readable(), std::forward<Dur>(dur));
-  if (n < 0 && n != -EINTR) {
-    throw std::system_error(std::error_code{-n, std::system_category()});
-  }
-  buffer->has_read(n);
-  co_return n;
+inline auto write_some(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, __kernel_timespec, true>;
+  return awaiter{sock, buffer, awaiter::ALL, make_timespec(std::forward<Dur>(dur))};
 }
 
 /// Write all bytes from buffer to sock, eof is treated as an error (`coring::eof_error` is thrown)
 template <typename Buffer, typename TcpConnection>
-inline async_task<> write_certain(TcpConnection *sock, Buffer *buffer, int nbytes) {
-  auto total = nbytes;
-  while (total != 0) {
-    auto n = co_await sock->send_some(buffer->front(), buffer->readable());
-    if (n == 0) {
-      throw coring::eof_error{};
-    }
-    if (n < 0 && n != -EINTR) {
-      throw std::system_error(std::error_code{-n, std::system_category()});
-    }
-    buffer->has_read(n);
-    total -= n;
-  }
+inline auto write_certain(TcpConnection *sock, Buffer *buffer, int nbytes) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, detail::no_timeout, false>;
+  return awaiter{sock, buffer, static_cast<size_t>(nbytes)};
 }
 
 /// Write all bytes from buffer to sock, eof is treated as an error (`coring::eof_error` is thrown)
+/// \param dur a duration for every separate send.
 template <typename Buffer, typename TcpConnection, class Dur>
-inline async_task<> write_certain(TcpConnection *sock, Buffer *buffer, int nbytes, Dur &&dur) {
-  auto total = nbytes;
-  while (total != 0) {
-    auto n = co_await sock->send_some(buffer->front(), buffer->readable(), std::forward<Dur>(dur));
-    if (n == 0) {
-      throw coring::eof_error{};
-    }
-    if (n < 0 && n != -EINTR) {
-      throw std::system_error(std::error_code{-n, std::system_category()});
-    }
-    buffer->has_read(n);
-    total -= n;
-  }
+inline auto write_certain(TcpConnection *sock, Buffer *buffer, int nbytes, Dur &&dur) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, __kernel_timespec, false>;
+  return awaiter{sock, buffer, static_cast<size_t>(nbytes), make_timespec(std::forward<Dur>(dur))};
 }
 
 /// Write all bytes from buffer to sock, eof is treated as an error (`coring::eof_error` is thrown)
 template <typename Buffer, typename TcpConnection>
-inline async_task<> write_all(TcpConnection *sock, Buffer *buffer) {
-  auto total = buffer->readable();
-  while (total != 0) {
-    auto n = co_await sock->send_some(buffer->front(), buffer->readable());
-    if (n == 0) {
-      throw coring::eof_error{};
+inline auto write_all(TcpConnection *sock, Buffer *buffer) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, detail::no_timeout, false>;
+  return awaiter{sock, buffer, awaiter::ALL};
+}
+
+/// Write all bytes from buffer to sock, eof is treated as an error (`coring::eof_error` is thrown)
+/// \param dur a duration for every separate send.
+template <typename Buffer, typename TcpConnection, class Dur>
+inline auto write_all(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
+  using awaiter = detail::buffer_write_awaiter<Buffer, TcpConnection, __kernel_timespec, false>;
+  return awaiter{sock, buffer, awaiter::ALL, make_timespec(std::forward<Dur>(dur))};
+}
+
+/// Write all bytes of the chain to sock by sendmsg, a.k.a. a single sqe for all the buffers (IOV_MAX at most),
+/// a partial write moves the head of the chain on. Eof is treated as an error (`coring::eof_error` is thrown)
+template <typename TcpConnection>
+inline auto write_all(TcpConnection *sock, buffer_chain *chain) {
+  return detail::chain_write_awaiter<TcpConnection>{sock, chain};
+}
+
+/// Write all bytes from buffer to sock with zero-copy sends (IORING_OP_SEND_ZC), eof is treated as an error
+/// (`coring::eof_error` is thrown).
+/// It returns (or throws) only after the kernel has posted the notifications of all sends, a.k.a. the buffer is free
+/// to be reused or destroyed then. A registered_buffer goes with IORING_RECVSEND_FIXED_BUF (no page pinning at all).
+/// Zero-copy pays page pinning and a notification per send, so it falls back to write_all below `threshold`
+/// bytes, or if the kernel/socket doesn't support it.
+template <typename Buffer, typename TcpConnection>
+inline task<void, pooled_frames> write_all_zc(TcpConnection *sock, Buffer *buffer, size_t threshold = SEND_ZC_THRESHOLD) {
+  auto &ctx = coro::get_io_context_ref();
+  if (buffer->readable() < threshold || !ctx.opcode_supported(IORING_OP_SEND_ZC)) {
+    co_await write_all(sock, buffer);
+    co_return;
+  }
+  auto token = new detail::multishot_token{};
+  detail::on_scope_exit cancel_at_exit{[&ctx, token] { ctx.cancel_multishot(token); }};
+  int err = 0;
+  while (buffer->readable() != 0) {
+    auto index = detail::registered_index(ctx, buffer->front(), buffer->readable());
+    ctx.send_zc(sock->io_fd(), buffer->front(), buffer->readable(), 0, token, 0, index, sock->io_flags());
+    // notifications of the former sends may come first.
+    int n;
+    while (true) {
+      auto [res, flags] = co_await token->next();
+      if (!(flags & IORING_CQE_F_NOTIF)) {
+        n = res;
+        break;
+      }
     }
-    if (n < 0 && n != -EINTR) {
-      throw std::system_error(std::error_code{-n, std::system_category()});
+    if (n > 0) {
+      buffer->has_read(n);
+    } else if (n != -EINTR) {
+      err = n;
+      break;
     }
-    buffer->has_read(n);
-    total = buffer->readable();
+  }
+  // the kernel may still be reading the buffer.
+  while (!token->drained()) {
+    co_await token->next();
+  }
+  if (err == -EOPNOTSUPP) {
+    co_await write_all(sock, buffer);
+  } else if (err < 0) {
+    throw std::system_error(std::error_code{-err, std::system_category()});
+  } else if (buffer->readable() != 0) {
+    throw coring::eof_error{};
   }
 }
 
-/// Write all bytes from buffer to sock, eof is treated as an error (`coring::eof_error` is thrown)
-template <typename Buffer, typename TcpConnection, class Dur>
-inline async_task<> write_all(TcpConnection *sock, Buffer *buffer, Dur &&dur) {
-  auto total = buffer->readable();
-  while (total != 0) {
-    auto n = co_await sock->send_some(buffer->front(), buffer->readable(), std::forward<Dur>(dur));
+/// Send [off, off + len) of `file` to `sock` without copying it to the user space: every round is a
+/// splice(file -> pipe) linked (IOSQE_IO_LINK) with a splice(pipe -> socket), a.k.a. two sqes and one
+/// submission, the pages go from the page cache to the socket by reference.
+/// The pipe comes from the pool of the context, throw coring::eof_error if the file is shorter than that.
+/// <p>Usage:</p>
+/// @code
+///  co_await write_all(&conn, &header);
+///  co_await send_file(&conn, &file, 0, file_size);
+/// @endcode
+template <typename TcpConnection, typename File>
+inline task<void, pooled_frames> send_file(TcpConnection *sock, File *file, off_t off, size_t len) {
+  auto &ctx = coro::get_io_context_ref();
+  auto pipe = ctx.pipes().acquire();
+  // spliced into the pipe but not out of it yet.
+  size_t in_pipe = 0;
+  detail::on_scope_exit give_back{[&ctx, &pipe, &in_pipe] { ctx.pipes().release(pipe, in_pipe == 0); }};
+  auto throw_if_failed = [](int n) {
+    if (n < 0) {
+      throw std::system_error(std::error_code{-n, std::system_category()});
+    }
     if (n == 0) {
       throw coring::eof_error{};
     }
-    if (n < 0 && n != -EINTR) {
-      throw std::system_error(std::error_code{-n, std::system_category()});
+  };
+  while (len != 0) {
+    auto chunk = std::min(len, pipe.capacity);
+    // NOTICE: both are awaited before the submission, or the one not awaited yet would lose its cqe.
+    auto [n_in, n_out] = co_await when_all(
+        ctx.splice(file->fd(), off, pipe.wr, -1, chunk, SPLICE_F_MOVE, IOSQE_IO_LINK),
+        ctx.splice(pipe.rd, -1, sock->io_fd(), -1, chunk, SPLICE_F_MOVE, sock->io_flags()));
+    if (n_in == -EINTR) {
+      continue;
+    }
+    throw_if_failed(n_in);
+    off += n_in;
+    len -= n_in;
+    in_pipe += n_in;
+    // a short splice into the pipe breaks the link, the second one is cancelled then.
+    if (n_out != -ECANCELED && n_out != -EINTR) {
+      throw_if_failed(n_out);
+      in_pipe -= n_out;
+    }
+    // the socket takes less than a pipe (or nothing), drain the pipe before the next round.
+    while (in_pipe != 0) {
+      auto n = co_await ctx.splice(pipe.rd, -1, sock->io_fd(), -1, in_pipe, SPLICE_F_MOVE, sock->io_flags());
+      if (n != -EINTR) {
+        throw_if_failed(n);
+        in_pipe -= n;
+      }
     }
-    buffer->has_read(n);
-    total = buffer->readable();
   }
 }
 
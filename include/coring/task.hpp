@@ -34,9 +34,10 @@
 #include "broken_promise.hpp"
 #include "coring/detail/async/remove_rvalue_reference.hpp"
 #include "coring/awaitable_traits.hpp"
+#include "coring/detail/async/frame_allocator.hpp"
 
 namespace coring {
-template <typename T>
+template <typename T = void, typename FrameTag = default_frames>
 class task;
 
 namespace detail {
@@ -68,8 +69,8 @@ class task_promise_base {
   std::coroutine_handle<> who_await_me_;
 };
 
-template <typename T>
-class task_promise final : public task_promise_base {
+template <typename T, typename FrameTag>
+class task_promise final : public task_promise_base, public frame_allocation<FrameTag> {
  public:
   task_promise() noexcept {};
 
@@ -86,7 +87,7 @@ class task_promise final : public task_promise_base {
     }
   }
 
-  task<T> get_return_object() noexcept;
+  task<T, FrameTag> get_return_object() noexcept;
 
   void unhandled_exception() noexcept {
     ::new (static_cast<void *>(std::addressof(m_exception))) std::exception_ptr(std::current_exception());
@@ -137,12 +138,12 @@ class task_promise final : public task_promise_base {
   };
 };
 
-template <>
-class task_promise<void> : public task_promise_base {
+template <typename FrameTag>
+class task_promise<void, FrameTag> : public task_promise_base, public frame_allocation<FrameTag> {
  public:
   task_promise() noexcept = default;
 
-  task<void> get_return_object() noexcept;
+  task<void, FrameTag> get_return_object() noexcept;
 
   void return_void() noexcept {}
 
@@ -158,12 +159,12 @@ class task_promise<void> : public task_promise_base {
   std::exception_ptr m_exception;
 };
 
-template <typename T>
-class task_promise<T &> : public task_promise_base {
+template <typename T, typename FrameTag>
+class task_promise<T &, FrameTag> : public task_promise_base, public frame_allocation<FrameTag> {
  public:
   task_promise() noexcept = default;
 
-  task<T &> get_return_object() noexcept;
+  task<T &, FrameTag> get_return_object() noexcept;
 
   void unhandled_exception() noexcept { m_exception = std::current_exception(); }
 
@@ -191,10 +192,13 @@ class task_promise<T &> : public task_promise_base {
 /// simply captures any passed parameters and returns exeuction to the
 /// caller. Execution of the coroutine body does not start until the
 /// coroutine is first co_await'ed.
-template <typename T = void>
+///
+/// task<T, pooled_frames> takes its frame from the per-thread freelists (detail/async/frame_allocator.hpp),
+/// for the short-lived ones made per message.
+template <typename T, typename FrameTag>
 class [[nodiscard]] task {
  public:
-  using promise_type = detail::task_promise<T>;
+  using promise_type = detail::task_promise<T, FrameTag>;
 
   using value_type = T;
 
@@ -310,18 +314,19 @@ struct async_run {
 };
 
 namespace detail {
-template <typename T>
-task<T> task_promise<T>::get_return_object() noexcept {
-  return task<T>{std::coroutine_handle<task_promise>::from_promise(*this)};
+template <typename T, typename FrameTag>
+task<T, FrameTag> task_promise<T, FrameTag>::get_return_object() noexcept {
+  return task<T, FrameTag>{std::coroutine_handle<task_promise>::from_promise(*this)};
 }
 
-inline task<void> task_promise<void>::get_return_object() noexcept {
-  return task<void>{std::coroutine_handle<task_promise>::from_promise(*this)};
+template <typename FrameTag>
+task<void, FrameTag> task_promise<void, FrameTag>::get_return_object() noexcept {
+  return task<void, FrameTag>{std::coroutine_handle<task_promise>::from_promise(*this)};
 }
 
-template <typename T>
-task<T &> task_promise<T &>::get_return_object() noexcept {
-  return task<T &>{std::coroutine_handle<task_promise>::from_promise(*this)};
+template <typename T, typename FrameTag>
+task<T &, FrameTag> task_promise<T &, FrameTag>::get_return_object() noexcept {
+  return task<T &, FrameTag>{std::coroutine_handle<task_promise>::from_promise(*this)};
 }
 }  // namespace detail
 template <typename Awaitable>
@@ -3,7 +3,10 @@
 #define CORING_TCP_CONNECTION_HPP
 
 #include "socket.hpp"
+#include "registered_buffer_arena.hpp"
 #include "coring/detail/time_utils.hpp"
+#include "coring/detail/io/io_loop_awaiter.hpp"
+#include "coring/detail/io/stoppable_awaiter.hpp"
 namespace coring::detail {
 /// templated function wraparound.
 /// I cannot make it static
@@ -35,6 +38,12 @@ struct _tcp_connection_helper {
     }
     throw std::system_error(std::error_code{ret_code, std::system_category()});
   }
+  /// put a socket just created by acceptor or connect_to into the fixed file table, if the context asks for it.
+  static inline void maybe_use_fixed_file(socket &so) {
+    if (coro::get_io_context_ref().fixed_files().auto_install()) {
+      so.use_fixed_file();
+    }
+  }
 };
 }  // namespace coring::detail
 namespace coring::tcp {
@@ -88,8 +97,9 @@ template <typename AddrOption>
 class connection_base : public socket, public AddrOption {
  private:
  public:
-  explicit connection_base(int fd) : socket{fd}, AddrOption{fd_} {}
-  explicit connection_base(socket &&so) : socket{std::move(so)}, AddrOption{fd_} {}
+  // pass the socket base itself, AddrOption{fd_} would make a temporary socket which closes the fd.
+  explicit connection_base(int fd) : socket{fd}, AddrOption{static_cast<const socket &>(*this)} {}
+  explicit connection_base(socket &&so) : socket{std::move(so)}, AddrOption{static_cast<const socket &>(*this)} {}
   connection_base(socket &&so, const net::endpoint &local, const net::endpoint &peer)
       : socket{std::move(so)}, AddrOption(local, peer) {}
   connection_base(socket &&so, const net::endpoint &end) : socket{std::move(so)}, AddrOption(end) {}
@@ -109,12 +119,17 @@ class connection_base : public socket, public AddrOption {
   /// \param nbytes expected count, short read may occurs
   /// \return
   inline detail::io_awaitable recv_some(char *dst, size_t nbytes, uint32_t fl = 0) {
-    return coro::get_io_context_ref().recv(fd_, (void *)dst, (unsigned)nbytes, fl);
+    auto &ctx = coro::get_io_context_ref();
+    // registered memory goes with READ_FIXED (no page pinning per op), recv flags can't be passed that way.
+    if (auto index = fl == 0 ? detail::registered_index(ctx, dst, nbytes) : -1; index >= 0) {
+      return ctx.read_fixed(io_fd(), dst, (unsigned)nbytes, 0, index, io_flags());
+    }
+    return ctx.recv(io_fd(), (void *)dst, (unsigned)nbytes, fl, io_flags());
   }
 
   /// try read some and wait for `dur` timeout at most, this could be useful to impl keepalive
   /// application like HTTP etc.
-  /// TODO: we can keep a constant kernal_timespec (relative) pool, to avoid coroutine overhead.
+  /// The timespec is kept in the awaiter, a.k.a. no coroutine frame for it.
   /// FIXME: the recv_some(Dur) is lazy when recv_some() is eager...
   /// \tparam Duration a std::chrono duration type
   /// \param dst
@@ -122,31 +137,77 @@ class connection_base : public socket, public AddrOption {
   /// \param dur a relative timeout
   /// \return
   template <typename Duration>
-  task<int> recv_some(char *dst, size_t nbytes, Duration &&dur, uint32_t fl = 0) {
-    auto read_awaitable = coro::get_io_context_ref().recv(fd_, (void *)dst, (unsigned)nbytes, fl, IOSQE_IO_LINK);
-    auto k = make_timespec(std::forward<Duration>(dur));
-    coro::get_io_context_ref().link_timeout(&k);
-    co_return co_await read_awaitable;
+  auto recv_some(char *dst, size_t nbytes, Duration &&dur, uint32_t fl = 0) {
+    return detail::linked_timeout_awaiter{
+        [this, dst, nbytes, fl] {
+          return coro::get_io_context_ref().recv(io_fd(), (void *)dst, (unsigned)nbytes, fl, io_flags());
+        },
+        make_timespec(std::forward<Duration>(dur))};
+  }
+
+  /// recv_some that completes with -ECANCELED if a stop is requested (on any thread) before it's done.
+  auto recv_some(char *dst, size_t nbytes, std::stop_token stop, uint32_t fl = 0) {
+    return with_stop(recv_some(dst, nbytes, fl), std::move(stop));
+  }
+
+  /// Receive every incoming segment into buffers selected from a group of the pool, using a single
+  /// multishot recv request, check buffer_pool_base::recv_stream.
+  /// <p>Usage:</p>
+  /// @code
+  ///  auto chunks = conn.recv_stream(pool, gid);
+  ///  for (auto it = co_await chunks.begin(); it != chunks.end(); co_await ++it) {
+  ///    auto buf = std::move(*it);
+  ///    co_await write_all(&conn, buf.get());
+  ///  }
+  /// @endcode
+  template <typename BufferPool>
+  auto recv_stream(BufferPool &pool, typename BufferPool::id_t gid) {
+    return pool.recv_stream(io_fd(), gid, io_flags());
   }
 
   inline detail::io_awaitable read_some(char *dst, size_t nbytes) {
-    return coro::get_io_context_ref().read(fd_, (void *)dst, (unsigned)nbytes, 0);
+    auto &ctx = coro::get_io_context_ref();
+    if (auto index = detail::registered_index(ctx, dst, nbytes); index >= 0) {
+      return ctx.read_fixed(io_fd(), dst, (unsigned)nbytes, 0, index, io_flags());
+    }
+    return ctx.read(io_fd(), (void *)dst, (unsigned)nbytes, 0, io_flags());
   }
 
+  /// WRITE_FIXED is used if the memory is inside the registered_buffer_arena of the context (and no flags),
+  /// so write_all etc. of a registered_buffer get it for free.
   inline detail::io_awaitable send_some(char *dst, size_t nbytes, uint32_t fl = 0) {
-    return coro::get_io_context_ref().send(fd_, (void *)dst, (unsigned)nbytes, fl);
+    auto &ctx = coro::get_io_context_ref();
+    if (auto index = fl == 0 ? detail::registered_index(ctx, dst, nbytes) : -1; index >= 0) {
+      return ctx.write_fixed(io_fd(), dst, (unsigned)nbytes, 0, index, io_flags());
+    }
+    return ctx.send(io_fd(), (void *)dst, (unsigned)nbytes, fl, io_flags());
   }
 
   template <typename Duration>
-  task<int> send_some(char *dst, size_t nbytes, Duration &&dur, uint32_t fl = 0) {
-    auto read_awaitable = coro::get_io_context_ref().send(fd_, (void *)dst, (unsigned)nbytes, fl, IOSQE_IO_LINK);
-    auto k = make_timespec(std::forward<Duration>(dur));
-    coro::get_io_context_ref().link_timeout(&k);
-    co_return co_await read_awaitable;
+  auto send_some(char *dst, size_t nbytes, Duration &&dur, uint32_t fl = 0) {
+    return detail::linked_timeout_awaiter{
+        [this, dst, nbytes, fl] {
+          return coro::get_io_context_ref().send(io_fd(), (void *)dst, (unsigned)nbytes, fl, io_flags());
+        },
+        make_timespec(std::forward<Duration>(dur))};
+  }
+
+  /// send_some that completes with -ECANCELED if a stop is requested (on any thread) before it's done.
+  auto send_some(char *dst, size_t nbytes, std::stop_token stop, uint32_t fl = 0) {
+    return with_stop(send_some(dst, nbytes, fl), std::move(stop));
+  }
+
+  /// Gather write, the msghdr (and its iovecs) must live until it's completed, check write_all(sock, buffer_chain*).
+  inline detail::io_awaitable sendmsg_some(const msghdr *msg, uint32_t fl = 0) {
+    return coro::get_io_context_ref().sendmsg(io_fd(), msg, fl, io_flags());
   }
 
   inline detail::io_awaitable write_some(char *dst, size_t nbytes) {
-    return coro::get_io_context_ref().write(fd_, (void *)dst, (unsigned)nbytes, 0);
+    auto &ctx = coro::get_io_context_ref();
+    if (auto index = detail::registered_index(ctx, dst, nbytes); index >= 0) {
+      return ctx.write_fixed(io_fd(), dst, (unsigned)nbytes, 0, index, io_flags());
+    }
+    return ctx.write(io_fd(), (void *)dst, (unsigned)nbytes, 0, io_flags());
   }
 
   /// set the linger option
@@ -210,14 +271,22 @@ typedef connection_base<socket_endpoints> socket_connection;
 /// local_connection;
 /// socket_connection; @endcode
 /// \param peer
+/// \param stop the connecting is cancelled if a stop is requested, std::system_error(ECANCELED) is thrown then.
 /// \return if you want to get a shared_ptr instead, just move it.
 /// ctor 13 at: https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
 template <typename CONN_TYPE = connection>
-task<CONN_TYPE> connect_to(const net::endpoint &peer) {
+task<CONN_TYPE> connect_to(const net::endpoint &peer, std::stop_token stop = {}) {
   int fd = tcp::new_socket_safe();
-  int ret = co_await coro::get_io_context_ref().connect(fd, peer.as_sockaddr(), net::endpoint::len);
+  int ret = co_await with_stop(coro::get_io_context_ref().connect(fd, peer.as_sockaddr(), net::endpoint::len),
+                               std::move(stop));
+  if (ret == -ECANCELED) {
+    ::close(fd);
+    throw std::system_error(std::error_code{ECANCELED, std::system_category()});
+  }
   detail::_tcp_connection_helper::handle_connect_error(-ret, fd);
-  co_return CONN_TYPE(fd);
+  CONN_TYPE conn(fd);
+  detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+  co_return conn;
 }
 
 /// It' s not safe for it create a socket fd implicitly,
@@ -234,7 +303,8 @@ task<CONN_TYPE> connect_to(const net::endpoint &peer) {
 ///  \param dur a time(relative duration)
 ///  \return if you want to get a shared_ptr instead, just move it.
 template <typename CONN_TYPE = connection, typename Duration>
-requires(!std::is_same_v<std::remove_cvref<Duration>, net::endpoint>) task<CONN_TYPE> connect_to(
+requires(!std::is_same_v<std::remove_cvref_t<Duration>, net::endpoint> &&
+         !std::is_same_v<std::remove_cvref_t<Duration>, std::stop_token>) task<CONN_TYPE> connect_to(
     const net::endpoint &peer, Duration &&dur) {
   int fd = tcp::new_socket_safe();
   auto connd_awaitable = coro::get_io_context_ref().connect(fd, peer.as_sockaddr(), net::endpoint::len, IOSQE_IO_LINK);
@@ -242,7 +312,9 @@ requires(!std::is_same_v<std::remove_cvref<Duration>, net::endpoint>) task<CONN_
   coro::get_io_context_ref().link_timeout(&k);
   int ret = co_await connd_awaitable;
   detail::_tcp_connection_helper::handle_connect_error(-ret, fd);
-  co_return CONN_TYPE(fd);
+  CONN_TYPE conn(fd);
+  detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+  co_return conn;
 }
 /// It' s not safe for it create a socket fd implicitly,
 /// If an exception is thrown, fd might be closed, might not...
@@ -267,7 +339,9 @@ task<CONN_TYPE> connect_to(const net::endpoint &local, const net::endpoint &peer
   coro::get_io_context_ref().link_timeout(&k);
   int ret = co_await connd_awaitable;
   detail::_tcp_connection_helper::handle_connect_error(-ret, fd);
-  co_return CONN_TYPE(fd, local, peer);
+  CONN_TYPE conn(fd, local, peer);
+  detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+  co_return conn;
 }
 /// The user need to create a socket by calling ::socket.../ or just tcp::new_socket_safe()
 /// this make sure the fd is maintained by caller, which can remake or freed even when
@@ -289,7 +363,9 @@ task<CONN_TYPE> connect_to(int fd, const net::endpoint &peer, Duration &&dur) {
   coro::get_io_context_ref().link_timeout(&k);
   int ret = co_await connd_awaitable;
   detail::_tcp_connection_helper::handle_connect_error(-ret);
-  co_return CONN_TYPE(fd);
+  CONN_TYPE conn(fd);
+  detail::_tcp_connection_helper::maybe_use_fixed_file(conn);
+  co_return conn;
 }
 }  // namespace coring::tcp
 
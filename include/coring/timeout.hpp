@@ -1,7 +1,10 @@
 
 #ifndef CORING_TIMEOUT_HPP
 #define CORING_TIMEOUT_HPP
+#include <cerrno>
+#include <concepts>
 #include "timeout_awaitable.hpp"
+#include "awaitable_traits.hpp"
 namespace coring {
 /// Use literal like 1us, only support us (I think ns is unnecessary)
 /// TODO: I think these casting is very roundabout...
@@ -26,5 +29,45 @@ detail::timeout_awaitable until(TimePoint p) {
   throw std::runtime_error("NOT SUPPORTED YET, reported by coring::until task");
   return {p, coro::get_io_context_ref()};
 }
+
+namespace detail {
+/// The timer side of with_timeout, cancel the io if the timer wins.
+/// Nothing of the with_timeout frame is touched after the cancel sqe is prepared, it may be gone then.
+inline async_run cancel_io_on_timeout(timeout_awaitable &timer, io_token *io, bool &timed_out) {
+  // NOTICE: g++ 12 miscompiles a co_await inside of the if condition here, keep it a statement.
+  bool fired = co_await timer;
+  if (!fired) {
+    // the io wins.
+    co_return;
+  }
+  timed_out = true;
+  io->cancel();
+}
+}  // namespace detail
+
+/// Race a io operation with a timeout, the loser is cancelled: the timer node is removed if the io completes first,
+/// or a IORING_OP_ASYNC_CANCEL is submitted for the io if the timer fires first.
+/// It always waits for the io to complete, so buffers passed to it are free to reuse after this.
+/// <p>Usage:</p>
+/// @code
+///  int n = co_await with_timeout(ctx.read(fd, buf, sz, 0), 3s);
+///  if (n == -ETIME) { ... }
+/// @endcode
+/// \param op a io_awaitable not co_awaited yet, e.g. ctx.read(...).
+/// \return the result of the io, -ETIME if it's cancelled by the timeout.
+template <typename IoAwaitable, typename Duration>
+requires std::derived_from<IoAwaitable, detail::io_awaitable_base> &&
+    std::same_as<typename awaitable_traits<IoAwaitable &>::await_result_t, int>
+task<int> with_timeout(IoAwaitable op, Duration expiration, io_context &ctx = coro::get_io_context_ref()) {
+  detail::timeout_awaitable timer{std::chrono::duration_cast<std::chrono::microseconds>(expiration), ctx};
+  bool timed_out = false;
+  detail::cancel_io_on_timeout(timer, &op, timed_out);
+  int res = co_await op;
+  timer.cancel();
+  if (timed_out && res == -ECANCELED) {
+    res = -ETIME;
+  }
+  co_return res;
+}
 }  // namespace coring
 #endif  // CORING_TIMEOUT_HPP
@@ -1,4 +1,3 @@
-
 #ifndef CORING_TIMEOUT_AWAITABLE_HPP
 #define CORING_TIMEOUT_AWAITABLE_HPP
 #pragma once
@@ -9,13 +8,35 @@ struct timeout_awaitable {
   timeout_awaitable(std::chrono::microseconds t, io_context &c) : timeout{t}, ioc{c} {}
   constexpr bool await_ready() const noexcept { return false; }
 
-  void await_suspend(std::coroutine_handle<> continuation) noexcept { ioc.register_timeout(continuation, timeout); }
+  void await_suspend(std::coroutine_handle<> continuation) noexcept {
+    waiter = continuation;
+    handle = ioc.register_timeout(continuation, timeout);
+  }
+
+  /// \return false if it's cancelled.
+  bool await_resume() noexcept {
+    waiter = nullptr;
+    return !cancelled;
+  }
 
-  constexpr void await_resume() const noexcept {}
+  /// Wake the waiter up at once with false, the timer node is removed.
+  /// Call it on the thread of the io_context.
+  /// \return false if it's not waiting (or already fired).
+  bool cancel() {
+    if (!waiter || !ioc.cancel_timeout(handle)) {
+      return false;
+    }
+    cancelled = true;
+    waiter.resume();
+    return true;
+  }
 
  private:
   std::chrono::microseconds timeout;
   io_context &ioc;
+  timer::handle_t handle{};
+  std::coroutine_handle<> waiter{nullptr};
+  bool cancelled{false};
 };
 }  // namespace coring::detail
 #endif  // CORING_TIMEOUT_AWAITABLE_HPP
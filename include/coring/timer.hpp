@@ -6,15 +6,20 @@
 #include <linux/time_types.h>
 #include <chrono>
 #include <map>
+#include <unordered_set>
+#include <ctime>
 
+#include "coring/coring_config.hpp"
 #include "coring/detail/time_utils.hpp"
 #include "coring/detail/skiplist_map.hpp"
+#include "coring/detail/timing_wheel.hpp"
 #include "coring/detail/noncopyable.hpp"
 
 namespace coring {
 class timer : noncopyable {
  public:
-  // We make a convention that the time_point would be measured in microsecond of epoch.
+  // We make a convention that the time_point would be measured in microsecond of CLOCK_MONOTONIC
+  // (immune to wall clock jumps), a.k.a. the loop time, check now().
   typedef long time_point_t;
   static constexpr time_point_t time_point_min_v = std::numeric_limits<time_point_t>::min();
   static constexpr time_point_t time_point_max_v = std::numeric_limits<time_point_t>::max();
@@ -25,16 +30,74 @@ class timer : noncopyable {
   using system_clock = std::chrono::system_clock;
   struct timer_token {
     std::coroutine_handle<> continuation;
+    // tell a reused wheel node from the one a handle refers to.
+    uint64_t id;
   };
+#ifndef CORING_TIMER_USE_SKIPLIST
+  // O(1) insertion and erasing, see pmr_benchmark for the numbers.
+  typedef coring::detail::timing_wheel<timer_token, time_point_t> timer_queue_t;
+#else
   // skiplist lost the game, but I still want to prevent a iterator invalidate.
   typedef coring::pmr::skiplist_map<time_point_t, timer_token, time_point_min_v, time_point_max_v> timer_queue_t;
   // typedef std::multimap<time_point_t, timer_token> timer_queue_t;
+#endif
 
-  timer_queue_t timer_queue_{};
+ public:
+  /// Returned by add_event, used to cancel a pending timeout.
+  struct handle_t {
+#ifndef CORING_TIMER_USE_SKIPLIST
+    timer_queue_t::handle_t node{nullptr};
+#endif
+    uint64_t id{0};
+  };
+
+ private:
+  static time_point_t read_clock() {
+    timespec ts{};
+#ifdef CORING_TIMER_COARSE_CLOCK
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec * 1'000'000L + ts.tv_nsec / 1'000;
+  }
+
+  static timer_queue_t make_queue(time_point_t now) {
+#ifndef CORING_TIMER_USE_SKIPLIST
+    // the wheel counts ticks from a base point.
+    return timer_queue_t{now};
+#else
+    return timer_queue_t{};
+#endif
+  }
+
+  void fire(timer_token &t) {
+#ifdef CORING_TIMER_USE_SKIPLIST
+    if (cancelled_.erase(t.id) != 0) {
+      return;
+    }
+#endif
+    t.continuation.resume();
+  }
+
+  // cached loop time, refreshed by the loop once per wakeup.
+  time_point_t now_{read_clock()};
+  timer_queue_t timer_queue_{make_queue(now_)};
+  uint64_t next_id_{1};
+#ifdef CORING_TIMER_USE_SKIPLIST
+  // no handle to erase with in skiplist, the cancelled ones are skipped (and forgotten) when they expire.
+  std::unordered_set<uint64_t> cancelled_{};
+#endif
 
  public:
   timer() = default;
   ~timer() = default;
+  /// Read the clock, the io_context calls it once per loop iteration (after waking up).
+  void update_now() { now_ = read_clock(); }
+
+  /// \return the cached loop time, it's a bit behind if the loop is busy.
+  [[nodiscard]] time_point_t now() const { return now_; }
+
   bool has_more_timeouts() {
     //    LOG_DEBUG_RAW("timer queue sz: %ld", timer_queue_.size());
     return !timer_queue_.empty();
@@ -42,12 +105,16 @@ class timer : noncopyable {
   /// call after verified the has_more_timeouts()
   /// \return a timespec(nanoseconds) for io_uring.
   __kernel_timespec get_next_expiration() {
+#ifndef CORING_TIMER_USE_SKIPLIST
+    // may be a bit earlier than the real one, handle_events() would just find nothing then.
+    auto stamp_event = microseconds(timer_queue_.next_expiration());
+#else
     auto it = timer_queue_.begin();
     // system_clock time_point by default use nanosecond as type
     auto stamp_event = microseconds(it->first);
+#endif
     // LOG_DEBUG_RAW("stamp event: %ld ms, first: %ld", stamp_event.count(), it->first);
-    auto stamp_now = std::chrono::duration_cast<microseconds>(system_clock::now().time_since_epoch());
-    auto dur_diff = stamp_event - stamp_now;
+    auto dur_diff = stamp_event - microseconds(now_);
     // LOG_DEBUG_RAW("dur diff in get next exp: %ld ms", std::chrono::duration_cast<microseconds>(dur_diff).count());
     // possible overflow
     return make_timespec(max(microseconds::zero(), (dur_diff)));
@@ -56,31 +123,44 @@ class timer : noncopyable {
     if (timer_queue_.empty()) {
       return 0;
     }
-    auto stamp_now = std::chrono::duration_cast<microseconds>(system_clock::now().time_since_epoch());
     int sz = 0;
     // we can't do this safely on multimap though.
-    timer_queue_.do_less_eq_then_pop(stamp_now.count(), [&sz](timer_token &t) -> void {
+    timer_queue_.do_less_eq_then_pop(now_, [this, &sz](timer_token &t) -> void {
       sz++;
-      t.continuation.resume();
+      fire(t);
     });
-    auto to_resume = timer_queue_.pop_less_eq(stamp_now.count());
-    //    LOG_DEBUG_RAW("pop less eqed");
-    //    timer_queue_.printKey();
-    for (auto &t : to_resume) {
-      t.continuation.resume();
-    }
     // BUG: 4 billion timeouts ?
     return static_cast<int>(sz);
   }
-  void add_event(std::coroutine_handle<> cont, std::chrono::microseconds timeout) {
-    auto stamp_now = std::chrono::duration_cast<microseconds>(system_clock::now().time_since_epoch());
-    auto wakeup_point = stamp_now + timeout;
+  /// \return a handle for cancel(), it's fine to drop it.
+  handle_t add_event(std::coroutine_handle<> cont, std::chrono::microseconds timeout) {
+    auto wakeup_point = microseconds(now_) + timeout;
     //    LOG_DEBUG_RAW("timeout %ldus, stamp : %ld wakeuppoint: %ld", timeout.count(), stamp_now.count(),
     //                  wakeup_point.count());
-    timer_queue_.emplace(wakeup_point.count(), timer_token{cont});
+    auto id = next_id_++;
+#ifndef CORING_TIMER_USE_SKIPLIST
+    return {timer_queue_.emplace(wakeup_point.count(), timer_token{cont, id}), id};
+#else
+    timer_queue_.emplace(wakeup_point.count(), timer_token{cont, id});
+    return {id};
+#endif
     //    LOG_DEBUG_RAW("add evented");
     //    timer_queue_.printKey();
   }
+  /// Remove a pending timeout, the continuation would never be resumed by the timer.
+  /// O(1) with the wheel, with the skiplist the entry stays until it expires, so only cancel a pending one.
+  /// \return false if it has already fired (or been cancelled).
+  bool cancel(handle_t h) {
+#ifndef CORING_TIMER_USE_SKIPLIST
+    if (h.node == nullptr || !timer_queue_t::linked(h.node) || h.node->value.id != h.id) {
+      return false;
+    }
+    timer_queue_.erase(h.node);
+    return true;
+#else
+    return h.id != 0 && cancelled_.insert(h.id).second;
+#endif
+  }
 };
 }  // namespace coring
 
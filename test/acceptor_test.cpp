@@ -0,0 +1,116 @@
+// acceptor_test.cpp
+// Created by PanJunzhong on 2022/5/2.
+//
+#include "coring/acceptor.hpp"
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+namespace {
+uint16_t bound_port(int listenfd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  ::getsockname(listenfd, reinterpret_cast<sockaddr *>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+/// connect synchronously, it completes as soon as the connection is in the backlog.
+std::vector<int> connect_n(uint16_t port, int n) {
+  std::vector<int> fds;
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int i = 0; i < n; i++) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    fds.push_back(fd);
+  }
+  return fds;
+}
+
+task<> accept_some(io_context *ctx, int n, bool direct, int *accepted) {
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  co_await acceptor.better_enable();
+  auto clients = connect_n(bound_port(acceptor.fd()), n);
+  {
+    auto fds = acceptor.accept_fd_stream(direct);
+    for (auto it = co_await fds.begin(); it != fds.end(); co_await ++it) {
+      EXPECT_GE(*it, 0);
+      if (direct) {
+        // the kernel allocates them in the range the fixed file table leaves to it.
+        EXPECT_GE(*it, static_cast<int>(ctx->fixed_files().direct_begin()));
+        EXPECT_LT(*it, static_cast<int>(ctx->fixed_files().capacity()));
+      }
+      if (++*accepted == n) {
+        break;
+      }
+    }
+    // the multishot accept is cancelled here.
+  }
+  for (auto fd : clients) {
+    ::close(fd);
+  }
+  ctx->stop();
+}
+
+task<> accept_connections(io_context *ctx, int n, bool fixed, int *accepted) {
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  auto clients = connect_n(bound_port(acceptor.fd()), n);
+  auto conns = acceptor.accept_stream<tcp::peer_connection>(fixed);
+  for (auto it = co_await conns.begin(); it != conns.end(); co_await ++it) {
+    auto conn = std::move(*it);
+    EXPECT_EQ(ntohs(conn.peer.port()), bound_port(clients[*accepted]));
+    EXPECT_EQ(conn.is_fixed_file(), fixed);
+    if (fixed) {
+      // the io goes by the slot.
+      EXPECT_EQ(::send(clients[*accepted], "hi", 2, 0), 2);
+      char buf[4];
+      EXPECT_EQ(co_await conn.recv_some(buf, sizeof(buf)), 2);
+    }
+    if (++*accepted == n) {
+      break;
+    }
+  }
+  for (auto fd : clients) {
+    ::close(fd);
+  }
+  ctx->stop();
+}
+}  // namespace
+
+TEST(Acceptor, MultishotAccept) {
+  io_context ctx;
+  int accepted = 0;
+  ctx.schedule(accept_some(&ctx, 8, false, &accepted));
+  ctx.run();
+  EXPECT_EQ(accepted, 8);
+}
+
+TEST(Acceptor, MultishotAcceptDirect) {
+  io_context ctx;
+  int accepted = 0;
+  ctx.schedule(accept_some(&ctx, 4, true, &accepted));
+  ctx.run();
+  EXPECT_EQ(accepted, 4);
+}
+
+TEST(Acceptor, AcceptStream) {
+  io_context ctx;
+  int accepted = 0;
+  ctx.schedule(accept_connections(&ctx, 4, false, &accepted));
+  ctx.run();
+  EXPECT_EQ(accepted, 4);
+}
+
+TEST(Acceptor, AcceptStreamOnFixedSlots) {
+  io_context ctx;
+  int accepted = 0;
+  ctx.schedule(accept_connections(&ctx, 4, true, &accepted));
+  ctx.run();
+  EXPECT_EQ(accepted, 4);
+  EXPECT_EQ(ctx.fixed_files().in_use(), 0);
+}
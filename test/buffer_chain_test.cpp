@@ -0,0 +1,74 @@
+// buffer_chain_test.cpp
+// Created by PanJunzhong on 2022/5/21.
+//
+#include "coring/buffer_chain.hpp"
+#include "coring/socket_writer.hpp"
+#include "coring/tcp_connection.hpp"
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+TEST(BufferChain, ConsumeAcrossIovecs) {
+  flex_buffer header(0);
+  header.push_back_string("HTTP/1.0 200 OK\r\n\r\n");
+  char body[] = "0123456789";
+  fixed_buffer block{body};
+  block.has_written(10);
+  buffer_chain chain;
+  chain.append(&header);
+  chain.append(&block);
+  chain.append("");  // skipped
+  chain.append(std::string_view{"tail"});
+  EXPECT_EQ(chain.iov_count(), 3);
+  EXPECT_EQ(chain.readable(), header.readable() + 10 + 4);
+  // the header and a part of the block.
+  chain.consume(header.readable() + 3);
+  EXPECT_EQ(chain.iov_count(), 2);
+  EXPECT_EQ(std::string_view(static_cast<char *>(chain.iov()->iov_base), chain.iov()->iov_len), "3456789");
+  chain.consume(7 + 4);
+  EXPECT_TRUE(chain.empty());
+  EXPECT_EQ(chain.iov_count(), 0);
+}
+
+namespace {
+/// more pieces than IOV_MAX, a.k.a. more than one sendmsg, and partial writes as the peer reads slowly.
+task<> write_pieces(io_context *ctx, std::string *expect, std::string *got) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::thread reader{[fd = fds[1], got] {
+    char tmp[4096];
+    ssize_t n;
+    while ((n = ::recv(fd, tmp, sizeof(tmp), 0)) > 0) {
+      got->append(tmp, static_cast<size_t>(n));
+    }
+  }};
+  {
+    std::vector<std::string> pieces;
+    for (int i = 0; i < 3000; i++) {
+      pieces.push_back(std::to_string(i) + std::string(static_cast<size_t>(i % 97), 'x') + ";");
+      *expect += pieces.back();
+    }
+    buffer_chain chain;
+    for (auto &p : pieces) {
+      chain.append(p);
+    }
+    tcp::connection conn{fds[0]};
+    co_await write_all(&conn, &chain);
+    EXPECT_TRUE(chain.empty());
+    co_await conn.close();
+  }
+  reader.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(BufferChain, WriteAllBySendmsg) {
+  io_context ctx;
+  std::string expect, got;
+  ctx.schedule(write_pieces(&ctx, &expect, &got));
+  ctx.run();
+  EXPECT_EQ(got, expect);
+}
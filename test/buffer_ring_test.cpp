@@ -0,0 +1,160 @@
+// buffer_ring_test.cpp
+// Created by PanJunzhong on 2022/5/3.
+//
+#include "coring/buffer_pool.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/timeout.hpp"
+#include <string>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+using namespace std::chrono_literals;
+
+namespace {
+constexpr int BLOCKS = 4;
+constexpr int BLOCK_BYTES = 64;
+char blocks[BLOCKS * BLOCK_BYTES];
+
+/// how many sqes the ring has taken so far.
+unsigned sqes_taken(io_context &ctx) { return ctx.get_ring_handle().sq.sqe_tail; }
+
+task<> echo_through_pipe(io_context *ctx, buffer_pool *pool, bool use_ring, unsigned *per_message) {
+  buffer_pool::id_t gid{"BR"};
+  if (use_ring) {
+    co_await pool->provide_group_ring(blocks, BLOCK_BYTES, BLOCKS, gid);
+  } else {
+    co_await pool->provide_group_contiguous(blocks, BLOCK_BYTES, BLOCKS, gid);
+  }
+  int fds[2];
+  EXPECT_EQ(::pipe(fds), 0);
+  constexpr int MESSAGES = BLOCKS * 4;
+  auto before = sqes_taken(*ctx);
+  for (int i = 0; i < MESSAGES; i++) {
+    auto msg = "message #" + std::to_string(i);
+    EXPECT_EQ(::write(fds[1], msg.data(), msg.size()), msg.size());
+    // more messages than blocks, a.k.a. it fails with ENOBUFS if buffers are not recycled.
+    auto buf = co_await pool->read(fds[0], gid);
+    EXPECT_EQ(std::string(buf->front(), buf->readable()), msg);
+  }
+  // let the provide_buffers sqes (if any) complete.
+  co_await ctx->yield();
+  *per_message = (sqes_taken(*ctx) - before) * 100 / MESSAGES;
+  ::close(fds[0]);
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(BufferRing, RecycleByTailBump) {
+  io_context ctx;
+  buffer_pool pool;
+  unsigned ring_sqes = 0;
+  ctx.schedule(echo_through_pipe(&ctx, &pool, true, &ring_sqes));
+  ctx.run();
+  if (!ctx.opcode_supported(IORING_OP_SOCKET)) {
+    GTEST_SKIP() << "no buffer ring before 5.19 (IORING_OP_SOCKET came with it)";
+  }
+  // one read sqe per message, no provide_buffers, the yield and the eventfd re-read (woken by schedule) add a bit.
+  EXPECT_LE(ring_sqes, 100 + 2 * 100 / 16);
+}
+
+TEST(BufferRing, ProvideBuffersTakesTwiceTheSqes) {
+  io_context ctx;
+  buffer_pool pool;
+  unsigned sqes = 0;
+  ctx.schedule(echo_through_pipe(&ctx, &pool, false, &sqes));
+  ctx.run();
+  EXPECT_GE(sqes, 200);
+}
+
+namespace {
+char small_blocks[2 * BLOCK_BYTES];
+
+task<> recv_segments(io_context *ctx, buffer_pool *pool, std::vector<std::string> *got) {
+  buffer_pool::id_t gid{"MR"};
+  // only 2 blocks for 8 segments, a.k.a. the group runs dry and the request is re-armed.
+  co_await pool->provide_group_contiguous(small_blocks, BLOCK_BYTES, 2, gid);
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+  for (int i = 0; i < 8; i++) {
+    auto msg = "segment #" + std::to_string(i);
+    EXPECT_EQ(::send(fds[1], msg.data(), msg.size(), 0), msg.size());
+  }
+  ::shutdown(fds[1], SHUT_WR);
+  tcp::connection conn{fds[0]};
+  auto chunks = conn.recv_stream(*pool, gid);
+  for (auto it = co_await chunks.begin(); it != chunks.end(); co_await ++it) {
+    auto buf = std::move(*it);
+    got->emplace_back(buf->front(), buf->readable());
+  }
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(BufferRing, MultishotRecvStream) {
+  io_context ctx;
+  buffer_pool pool;
+  std::vector<std::string> got;
+  ctx.schedule(recv_segments(&ctx, &pool, &got));
+  ctx.run();
+  ASSERT_EQ(got.size(), 8);
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(got[i], "segment #" + std::to_string(i));
+  }
+}
+
+namespace {
+char held_blocks[2 * BLOCK_BYTES];
+
+/// the consumer holds both buffers, the stream has to wait for one to come back instead of re-arming in a loop.
+task<> hold_every_buffer(io_context *ctx, buffer_pool *pool, bool use_ring, std::vector<std::string> *got,
+                         unsigned *parked_sqes) {
+  buffer_pool::id_t gid{use_ring ? "HR" : "HC"};
+  if (use_ring) {
+    co_await pool->provide_group_ring(held_blocks, BLOCK_BYTES, 2, gid);
+  } else {
+    co_await pool->provide_group_contiguous(held_blocks, BLOCK_BYTES, 2, gid);
+  }
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::vector<selected_buffer_resource<>> held;
+  auto chunks = conn.recv_stream(*pool, gid);
+  EXPECT_EQ(::send(fds[1], "first", 5, 0), 5);
+  auto it = co_await chunks.begin();
+  held.push_back(std::move(*it));
+  EXPECT_EQ(::send(fds[1], "second", 6, 0), 6);
+  co_await ++it;
+  held.push_back(std::move(*it));
+  // no buffer left for it.
+  EXPECT_EQ(::send(fds[1], "third", 5, 0), 5);
+  [](io_context *ctx, std::vector<selected_buffer_resource<>> *held, unsigned *parked_sqes) -> async_run {
+    auto before = sqes_taken(*ctx);
+    co_await timeout(20ms);
+    *parked_sqes = sqes_taken(*ctx) - before;
+    held->pop_back();
+  }(ctx, &held, parked_sqes);
+  co_await ++it;
+  for (auto &buf : held) {
+    got->emplace_back(buf->front(), buf->readable());
+  }
+  got->emplace_back((*it)->front(), (*it)->readable());
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(BufferRing, StreamWaitsForARecycledBuffer) {
+  for (bool use_ring : {true, false}) {
+    io_context ctx;
+    buffer_pool pool;
+    std::vector<std::string> got;
+    unsigned parked_sqes = 0;
+    ctx.schedule(hold_every_buffer(&ctx, &pool, use_ring, &got, &parked_sqes));
+    ctx.run();
+    EXPECT_EQ(got, (std::vector<std::string>{"first", "third"}));
+    // the timeout and the re-armed recv (ENOBUFS once) at most, no yield loop.
+    EXPECT_LE(parked_sqes, 3);
+  }
+}
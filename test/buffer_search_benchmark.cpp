@@ -0,0 +1,87 @@
+// buffer_search_benchmark.cpp
+// Created by PanJunzhong on 2022/5/23.
+//
+// CRLF/CRLFCRLF search on http request headers of 1~8KB, as HttpContext::parseRequest does it:
+// a find_crlf per header line, and a find_2crlf over the whole block. Build it as Release (-O2) to get numbers.
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <coring/detail/search.hpp>
+using namespace std;
+namespace search = coring::detail::search;
+constexpr int ROUNDS = 20000;
+volatile size_t sink;
+
+string make_header(size_t size) {
+  static const char *names[] = {"Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Cookie",
+                                "Referer", "Cache-Control", "X-Forwarded-For", "Authorization"};
+  string h = "GET /static/js/app.8c1f2e.js?v=20220523 HTTP/1.1\r\n";
+  unsigned seed = 12345;
+  for (int i = 0; h.size() + 4 < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    h += names[i % 10];
+    h += ": ";
+    h += string(8 + (seed >> 16) % 120, 'a' + i % 26);
+    h += "\r\n";
+  }
+  h.resize(size - 4);
+  // no stray CR in the cut line.
+  replace(h.end() - 2, h.end(), '\r', 'x');
+  return h + "\r\n\r\n";
+}
+
+using crlf_fn = const char *(*)(const char *, const char *);
+
+const char *std_crlf(const char *b, const char *e) {
+  auto p = std::search(b, e, "\r\n", "\r\n" + 2);
+  return p == e ? nullptr : p;
+}
+
+const char *std_2crlf(const char *b, const char *e) {
+  auto p = std::search(b, e, "\r\n\r\n", "\r\n\r\n" + 4);
+  return p == e ? nullptr : p;
+}
+
+template <typename F>
+double ns_per_block(F &&f) {
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    sink = f();
+  }
+  auto diff = chrono::steady_clock::now() - start;
+  return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(diff).count()) / ROUNDS;
+}
+
+void run(const string &h, const char *name, crlf_fn crlf, crlf_fn crlf2) {
+  const char *b = h.data();
+  const char *e = b + h.size();
+  auto lines = ns_per_block([&] {
+    size_t n = 0;
+    for (auto p = b; (p = crlf(p, e)) != nullptr; p += 2) {
+      n++;
+    }
+    return n;
+  });
+  auto whole = ns_per_block([&] { return static_cast<size_t>(crlf2(b, e) - b); });
+  cout << "  " << name << "\tlines: " << lines << "ns (" << h.size() / lines << "GB/s)\tcrlfcrlf: " << whole
+       << "ns (" << h.size() / whole << "GB/s)" << endl;
+}
+
+int main() {
+  cout << "active kernels: " << search::active_kernels().name << endl;
+  for (size_t size : {1024, 2048, 4096, 8192}) {
+    auto h = make_header(size);
+    cout << size << " bytes header, " << count(h.begin(), h.end(), '\n') << " lines" << endl;
+    run(h, "std::search", std_crlf, std_2crlf);
+    run(h, "scalar", search::scalar::find_crlf, search::scalar::find_2crlf);
+#ifdef CORING_SEARCH_X86
+    run(h, "sse2", search::sse2::find_crlf, search::sse2::find_2crlf);
+    if (__builtin_cpu_supports("avx2")) {
+      run(h, "avx2", search::avx2::find_crlf, search::avx2::find_2crlf);
+    }
+#endif
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+// buffer_search_test.cpp
+// Created by PanJunzhong on 2022/5/23.
+//
+#include "coring/buffer.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+using namespace coring;
+namespace search = coring::detail::search;
+
+namespace {
+std::vector<search::kernels> all_kernels() {
+  std::vector<search::kernels> ks{search::scalar_kernels};
+#ifdef CORING_SEARCH_X86
+  ks.push_back(search::sse2_kernels);
+  if (__builtin_cpu_supports("avx2")) {
+    ks.push_back(search::avx2_kernels);
+  }
+#endif
+  return ks;
+}
+
+const char *expected(const char *b, const char *e, std::string_view needle) {
+  auto p = std::search(b, e, needle.begin(), needle.end());
+  return p == e ? nullptr : p;
+}
+}  // namespace
+
+TEST(BufferSearch, KernelsAgreeWithStdSearch) {
+  // mostly '\r' and '\n' so that partial matches are everywhere, crossing the 16/32 bytes blocks.
+  const char alphabet[] = "\r\n\r\nab:";
+  std::mt19937 rng{20220523};
+  std::string s(300, 'x');
+  for (int round = 0; round < 200; round++) {
+    for (auto &c : s) {
+      c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+    // sparse ones, a match sits behind a long run.
+    if (round % 2 == 0) {
+      std::fill(s.begin(), s.end(), 'x');
+      s[rng() % s.size()] = '\r';
+      auto at = rng() % (s.size() - 3);
+      s.replace(at, 4, "\r\n\r\n");
+    }
+    for (auto &k : all_kernels()) {
+      for (size_t off = 0; off < 40; off++) {
+        for (size_t len : {size_t{0}, size_t{1}, size_t{3}, size_t{17}, size_t{35}, size_t{64}, s.size() - off}) {
+          const char *b = s.data() + off;
+          const char *e = b + len;
+          EXPECT_EQ(k.find_crlf(b, e), expected(b, e, "\r\n")) << k.name;
+          EXPECT_EQ(k.find_2crlf(b, e), expected(b, e, "\r\n\r\n")) << k.name;
+          EXPECT_EQ(k.find_byte(b, e, ':'), expected(b, e, ":")) << k.name;
+        }
+      }
+    }
+  }
+}
+
+TEST(BufferSearch, BufferFinds) {
+  buffer bf{};
+  std::string req = "GET / HTTP/1.1\r\nHost: a\r\n\r\nbody";
+  bf.push_back(req.data(), req.size());
+  EXPECT_EQ(bf.find_crlf(), bf.front() + 14);
+  EXPECT_EQ(bf.find_crlf(bf.front() + 15), bf.front() + 23);
+  EXPECT_EQ(bf.find_2crlf(), bf.front() + 23);
+  EXPECT_EQ(bf.find(':'), bf.front() + 20);
+  EXPECT_EQ(bf.find_eol(), bf.front() + 15);
+  EXPECT_EQ(bf.find('#'), nullptr);
+  bf.has_read(27);
+  EXPECT_EQ(bf.find_crlf(), nullptr);
+  EXPECT_EQ(bf.find_2crlf(), nullptr);
+  EXPECT_EQ(bf.find_eol(), nullptr);
+}
@@ -0,0 +1,72 @@
+// buffer_storage_test.cpp
+// Created by PanJunzhong on 2022/5/26.
+//
+#include "coring/buffer.hpp"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+using namespace coring;
+using detail::buffer_storage_lists;
+
+TEST(BufferStorage, SizeClasses) {
+  EXPECT_EQ(buffer_storage_lists::class_of(1), 0);
+  EXPECT_EQ(buffer_storage_lists::class_of(128), 0);
+  EXPECT_EQ(buffer_storage_lists::class_of(129), 1);
+  EXPECT_EQ(buffer_storage_lists::size_of(buffer_storage_lists::class_of(512)), 512);
+  EXPECT_EQ(buffer_storage_lists::size_of(buffer_storage_lists::CLASSES - 1), BUFFER_STORAGE_MAX_CLASS);
+}
+
+TEST(BufferStorage, ShortLivedBuffersReuseStorage) {
+  const char *first;
+  {
+    flex_buffer header(512);
+    first = header.data();
+  }
+  auto c = buffer_storage_lists::class_of(512);
+  auto idle = buffer_storage_lists::idle(c);
+  EXPECT_GE(idle, 1);
+  for (int i = 0; i < 100; i++) {
+    flex_buffer header(512);
+    EXPECT_EQ(header.data(), first);
+    header.push_back_string("HTTP/1.1 200 OK\r\n");
+  }
+  EXPECT_EQ(buffer_storage_lists::idle(c), idle);
+}
+
+TEST(BufferStorage, GrowKeepsBytes) {
+  flex_buffer buf(128);
+  std::string s(100, 'a');
+  buf.push_back(s.data(), s.size());
+  buf.has_read(50);
+  std::string t(5000, 'b');
+  buf.push_back(t.data(), t.size());
+  EXPECT_EQ(buf.readable_view(), std::string(50, 'a') + t);
+}
+
+TEST(BufferStorage, IdleBlocksAreCapped) {
+  auto c = buffer_storage_lists::class_of(2048);
+  {
+    std::vector<std::unique_ptr<flex_buffer>> bufs;
+    for (unsigned i = 0; i < BUFFER_STORAGE_IDLE_PER_CLASS + 10; i++) {
+      bufs.push_back(std::make_unique<flex_buffer>(2048));
+    }
+  }
+  EXPECT_EQ(buffer_storage_lists::idle(c), BUFFER_STORAGE_IDLE_PER_CLASS);
+  // beyond the largest class, not pooled.
+  auto before = buffer_storage_lists::idle(buffer_storage_lists::CLASSES - 1);
+  { flex_buffer big(BUFFER_STORAGE_MAX_CLASS + 1); }
+  EXPECT_EQ(buffer_storage_lists::idle(buffer_storage_lists::CLASSES - 1), before);
+}
+
+TEST(BufferStorage, FreedOnAnotherThread) {
+  auto c = buffer_storage_lists::class_of(4096);
+  auto idle = buffer_storage_lists::idle(c);
+  std::unique_ptr<flex_buffer> made;
+  std::thread t{[&made] { made = std::make_unique<flex_buffer>(4096); }};
+  t.join();
+  made.reset();
+  // it joins the freelist of this thread.
+  EXPECT_EQ(buffer_storage_lists::idle(c), idle + 1);
+}
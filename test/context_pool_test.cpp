@@ -2,5 +2,172 @@
 // Created by PanJunzhong on 2022/4/29.
 //
 #include "coring/context_pool.h"
+#include <atomic>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <gtest/gtest.h>
+using namespace coring;
 
-int main(void) { return 0; }
\ No newline at end of file
+namespace {
+std::atomic<int> finished{0};
+std::mutex mu;
+std::set<std::thread::id> seen_threads;
+std::set<io_context *> seen_contexts;
+
+task<> record_where_i_am() {
+  using namespace std::chrono_literals;
+  // make sure the task is really resumed by the loop
+  co_await coro::get_io_context_ref().timeout(1ms);
+  {
+    std::lock_guard lk{mu};
+    seen_threads.insert(std::this_thread::get_id());
+    seen_contexts.insert(coro::get_io_context());
+  }
+  finished++;
+}
+
+void wait_for(int n) {
+  for (int i = 0; i < 500 && finished.load() < n; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+void reset() {
+  finished = 0;
+  seen_threads.clear();
+  seen_contexts.clear();
+}
+}  // namespace
+
+TEST(ContextPool, RoundRobin) {
+  reset();
+  context_pool pool{4};
+  pool.start();
+  for (int i = 0; i < 40; i++) {
+    pool.spawn(record_where_i_am());
+  }
+  wait_for(40);
+  pool.stop();
+  EXPECT_EQ(finished.load(), 40);
+  EXPECT_EQ(seen_contexts.size(), 4);
+  EXPECT_EQ(seen_threads.size(), 4);
+}
+
+namespace {
+/// a long-lived task pinning load on its context until released.
+task<> hold_until(std::atomic<bool> *released) {
+  using namespace std::chrono_literals;
+  while (!released->load()) {
+    co_await coro::get_io_context_ref().timeout(1ms);
+  }
+}
+
+void wait_idle(io_context &ctx) {
+  for (int i = 0; i < 500 && ctx.load() != 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+}  // namespace
+
+TEST(ContextPool, LeastLoaded) {
+  reset();
+  context_pool pool{3};
+  pool.start();
+  std::atomic<bool> released[4]{};
+  // the load counts a task as soon as it's queued, a.k.a. one per context in order.
+  EXPECT_EQ(&pool.spawn(hold_until(&released[0]), context_pool::placement::least_loaded), &pool[0]);
+  EXPECT_EQ(&pool.spawn(hold_until(&released[1]), context_pool::placement::least_loaded), &pool[1]);
+  EXPECT_EQ(&pool.spawn(hold_until(&released[2]), context_pool::placement::least_loaded), &pool[2]);
+  // a tie goes to the lower index.
+  EXPECT_EQ(&pool.spawn(hold_until(&released[3]), context_pool::placement::least_loaded), &pool[0]);
+  // loads are 2, 0, 1 then, new tasks go to the idle one.
+  released[1] = true;
+  wait_idle(pool[1]);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(&pool.spawn(record_where_i_am(), context_pool::placement::least_loaded), &pool[1]);
+    wait_for(i + 1);
+    wait_idle(pool[1]);
+  }
+  for (auto &r : released) {
+    r = true;
+  }
+  wait_idle(pool[0]);
+  wait_idle(pool[2]);
+  pool.stop();
+  EXPECT_EQ(finished.load(), 5);
+  EXPECT_EQ(seen_contexts, std::set<io_context *>{&pool[1]});
+}
+
+TEST(ContextPool, ScheduleBeforeStart) {
+  reset();
+  context_pool pool{2};
+  pool.spawn_on_each([](size_t) { return record_where_i_am(); });
+  pool.start();
+  wait_for(2);
+  pool.stop();
+  EXPECT_EQ(finished.load(), 2);
+  EXPECT_EQ(seen_contexts.size(), 2);
+}
+
+TEST(ContextPool, SharedWorkerPool) {
+  context_pool pool{2, 64, 0, false};
+  EXPECT_TRUE(pool[1].get_ring_handle().flags & IORING_SETUP_ATTACH_WQ);
+  pool.start();
+  pool.stop();
+}
+
+namespace {
+std::atomic<int> pongs{0};
+
+task<> pong(io_context *home) {
+  EXPECT_NE(coro::get_io_context(), home);
+  dispatch_to(*home, []() -> task<> {
+    pongs++;
+    co_return;
+  }());
+  co_return;
+}
+
+task<> ping(io_context *peer, int n) {
+  auto home = coro::get_io_context();
+  for (int i = 0; i < n; i++) {
+    dispatch_to(*peer, pong(home));
+    if (i % 8 == 0) {
+      co_await home->yield();
+    }
+  }
+}
+}  // namespace
+
+TEST(ContextPool, DispatchPingPong) {
+  pongs = 0;
+  context_pool pool{2, 64, 0, false};
+  pool.start();
+  pool[0].post(ping(&pool[1], 100));
+  for (int i = 0; i < 500 && pongs.load() < 100; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  pool.stop();
+  EXPECT_EQ(pongs.load(), 100);
+}
+
+TEST(ContextPool, PostFromManyThreads) {
+  reset();
+  context_pool pool{1, 64, 0, false};
+  pool.start();
+  {
+    std::vector<std::jthread> posters;
+    for (int i = 0; i < 4; i++) {
+      posters.emplace_back([&pool] {
+        for (int j = 0; j < 25; j++) {
+          pool[0].post(record_where_i_am());
+        }
+      });
+    }
+  }
+  wait_for(100);
+  pool.stop();
+  EXPECT_EQ(finished.load(), 100);
+  EXPECT_EQ(seen_contexts.size(), 1);
+}
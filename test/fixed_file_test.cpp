@@ -0,0 +1,145 @@
+// fixed_file_test.cpp
+// Created by PanJunzhong on 2022/5/18.
+//
+#include "coring/acceptor.hpp"
+#include "coring/tcp_connection.hpp"
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+TEST(FixedFile, TableRecyclesSlots) {
+  io_context ctx;
+  // the last slot is left to the kernel.
+  detail::fixed_file_table table{&ctx.get_ring_handle(), 3, 1};
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  EXPECT_EQ(table.install(fds[0]), 0);
+  EXPECT_EQ(table.install(fds[1]), 1);
+  // full, the caller keeps using the fd.
+  EXPECT_EQ(table.install(fds[1]), -1);
+  EXPECT_EQ(table.in_use(), 2);
+  table.release(0);
+  EXPECT_EQ(table.install(fds[1]), 0);
+  table.release(0);
+  table.release(1);
+  EXPECT_EQ(table.in_use(), 0);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+namespace {
+task<> talk_over_fixed_slot(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  EXPECT_TRUE(conn.use_fixed_file());
+  EXPECT_EQ(conn.io_flags(), IOSQE_FIXED_FILE);
+  EXPECT_EQ(ctx->fixed_files().in_use(), 1);
+  char out[] = "ping";
+  EXPECT_EQ(co_await conn.send_some(out, 4), 4);
+  char in[8]{};
+  EXPECT_EQ(::recv(fds[1], in, sizeof(in), 0), 4);
+  EXPECT_EQ(std::string_view(in, 4), "ping");
+  EXPECT_EQ(::send(fds[1], "pong", 4, 0), 4);
+  EXPECT_EQ(co_await conn.recv_some(in, sizeof(in)), 4);
+  EXPECT_EQ(std::string_view(in, 4), "pong");
+  co_await conn.close();
+  EXPECT_EQ(ctx->fixed_files().in_use(), 0);
+  // the slot is cleared, a.k.a. the peer sees EOF instead of a connection kept open by the table.
+  EXPECT_EQ(::recv(fds[1], in, sizeof(in), MSG_DONTWAIT), 0);
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+uint16_t bound_port(int listenfd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  ::getsockname(listenfd, reinterpret_cast<sockaddr *>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+task<> accept_and_connect_fixed(io_context *ctx) {
+  ctx->fixed_files().set_auto_install(true);
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  auto client = co_await tcp::connect_to(net::endpoint{"127.0.0.1", bound_port(acceptor.fd())});
+  auto server = co_await acceptor.accept();
+  EXPECT_TRUE(client.is_fixed_file());
+  EXPECT_TRUE(server.is_fixed_file());
+  EXPECT_EQ(ctx->fixed_files().in_use(), 2);
+  char out[] = "hello";
+  EXPECT_EQ(co_await client.send_some(out, 5), 5);
+  char in[8]{};
+  EXPECT_EQ(co_await server.recv_some(in, sizeof(in)), 5);
+  EXPECT_EQ(std::string_view(in, 5), "hello");
+  co_await client.close();
+  EXPECT_EQ(co_await server.recv_some(in, sizeof(in)), 0);
+  co_await server.close();
+  EXPECT_EQ(ctx->fixed_files().in_use(), 0);
+  ctx->stop();
+}
+
+/// the kernel allocates direct descriptors while sockets are installed by us, in the same table.
+task<> direct_accept_with_auto_install(io_context *ctx) {
+  auto &table = ctx->fixed_files();
+  table.set_auto_install(true);
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  net::endpoint addr{"127.0.0.1", bound_port(acceptor.fd())};
+  std::vector<tcp::connection> clients;
+  std::vector<int> slots;
+  {
+    auto fds = acceptor.accept_fd_stream(true);
+    for (int i = 0; i < 3; i++) {
+      clients.push_back(co_await tcp::connect_to(addr));
+      EXPECT_TRUE(clients.back().is_fixed_file());
+      EXPECT_LT(clients.back().io_fd(), static_cast<int>(table.direct_begin()));
+    }
+    for (auto it = co_await fds.begin(); it != fds.end(); co_await ++it) {
+      EXPECT_GE(*it, static_cast<int>(table.direct_begin()));
+      slots.push_back(*it);
+      if (slots.size() == clients.size()) {
+        break;
+      }
+    }
+  }
+  EXPECT_EQ(table.in_use(), 3);
+  // every side talks over its own slot, a.k.a. none is overwritten by the other allocator.
+  for (size_t i = 0; i < clients.size(); i++) {
+    char out[] = "hi0";
+    out[2] = static_cast<char>('0' + i);
+    EXPECT_EQ(co_await clients[i].send_some(out, 3), 3);
+    char in[4]{};
+    int n = co_await ctx->recv(slots[i], in, sizeof(in), 0, IOSQE_FIXED_FILE);
+    EXPECT_EQ(n, 3);
+    EXPECT_EQ(std::string_view(in, 3), std::string_view(out, 3));
+    table.release_direct(slots[i]);
+  }
+  for (auto &conn : clients) {
+    co_await conn.close();
+  }
+  EXPECT_EQ(table.in_use(), 0);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(FixedFile, ConnectionOverFixedSlot) {
+  io_context ctx;
+  ctx.schedule(talk_over_fixed_slot(&ctx));
+  ctx.run();
+}
+
+TEST(FixedFile, AcceptAndConnectAutoInstall) {
+  io_context ctx;
+  ctx.schedule(accept_and_connect_fixed(&ctx));
+  ctx.run();
+}
+
+TEST(FixedFile, DirectAcceptWithAutoInstall) {
+  io_context ctx;
+  ctx.schedule(direct_accept_with_auto_install(&ctx));
+  ctx.run();
+}
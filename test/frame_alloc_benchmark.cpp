@@ -0,0 +1,109 @@
+// frame_alloc_benchmark.cpp
+// Created by PanJunzhong on 2022/5/27.
+//
+// Global operator new calls per echoed message, a ping-pong over a socketpair as echo_server's echo_loop
+// does it: a read coroutine and a write_all coroutine per message. The same loop with default_frames (every
+// frame is a malloc), pooled_frames, and the library's read_some/write_all.
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <sys/socket.h>
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_reader.hpp"
+#include "coring/socket_writer.hpp"
+using namespace coring;
+constexpr int MESSAGES = 20000;
+constexpr size_t MESSAGE_LEN = 64;
+
+std::atomic<size_t> news{0};
+
+void *operator new(size_t n) {
+  news.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(n == 0 ? 1 : n)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// read_some and write_all with the frames of the tag.
+template <typename Tag>
+async_task<int, Tag> read_with(tcp::connection *conn, flex_buffer *buf) {
+  buf->make_room(READ_BUFFER_AT_LEAST_WRITABLE);
+  int n = co_await conn->recv_some(buf->back(), buf->writable());
+  if (n <= 0) {
+    throw eof_error{};
+  }
+  buf->has_written(n);
+  co_return n;
+}
+
+template <typename Tag>
+async_task<void, Tag> write_with(tcp::connection *conn, flex_buffer *buf) {
+  while (buf->readable() != 0) {
+    int n = co_await conn->send_some(buf->front(), buf->readable());
+    if (n <= 0) {
+      throw eof_error{};
+    }
+    buf->has_read(n);
+  }
+}
+
+struct with_default {
+  static auto read(tcp::connection *c, flex_buffer *b) { return read_with<default_frames>(c, b); }
+  static auto write(tcp::connection *c, flex_buffer *b) { return write_with<default_frames>(c, b); }
+};
+struct with_pooled {
+  static auto read(tcp::connection *c, flex_buffer *b) { return read_with<pooled_frames>(c, b); }
+  static auto write(tcp::connection *c, flex_buffer *b) { return write_with<pooled_frames>(c, b); }
+};
+struct with_library {
+  static auto read(tcp::connection *c, flex_buffer *b) { return read_some(c, b); }
+  static auto write(tcp::connection *c, flex_buffer *b) { return write_all(c, b); }
+};
+
+template <typename Loop>
+task<> echo(io_context *ctx, const char *name) {
+  int fds[2];
+  ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  tcp::connection conn{fds[0]};
+  std::thread peer{[fd = fds[1]] {
+    char msg[MESSAGE_LEN] = {'x'};
+    for (int i = 0; i < MESSAGES; i++) {
+      ::send(fd, msg, sizeof(msg), 0);
+      for (size_t got = 0; got < sizeof(msg);) {
+        got += ::recv(fd, msg, sizeof(msg) - got, 0);
+      }
+    }
+  }};
+  flex_buffer buf{MESSAGE_LEN * 2};
+  // warm the freelists up, as a long-running server would be.
+  co_await Loop::read(&conn, &buf);
+  co_await Loop::write(&conn, &buf);
+  auto before = news.load();
+  for (int i = 1; i < MESSAGES; i++) {
+    co_await Loop::read(&conn, &buf);
+    co_await Loop::write(&conn, &buf);
+  }
+  auto per_message = static_cast<double>(news.load() - before) / (MESSAGES - 1);
+  std::cout << name << ": " << per_message << " operator new per echoed message" << std::endl;
+  peer.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+template <typename Loop>
+void run(const char *name) {
+  io_context ctx;
+  ctx.schedule(echo<Loop>(&ctx, name));
+  ctx.run();
+}
+
+int main() {
+  run<with_default>("default_frames");
+  run<with_pooled>("pooled_frames");
+  run<with_library>("read_some/write_all");
+}
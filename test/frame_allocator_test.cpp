@@ -0,0 +1,78 @@
+// frame_allocator_test.cpp
+// Created by PanJunzhong on 2022/5/27.
+//
+#include "coring/task.hpp"
+#include "coring/async_task.hpp"
+#include "coring/io_context.hpp"
+#include <string>
+#include <thread>
+#include <gtest/gtest.h>
+using namespace coring;
+using detail::frame_lists;
+
+namespace {
+task<int, pooled_frames> add_one(int x) { co_return x + 1; }
+
+async_task<std::string, pooled_frames> hello() { co_return "hello"; }
+
+task<int, pooled_frames> sum(int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++) {
+    s += co_await add_one(i);
+  }
+  co_return s;
+}
+
+size_t idle_frames() {
+  size_t n = 0;
+  for (size_t c = 0; c < frame_lists::CLASSES; c++) {
+    n += frame_lists::idle(c);
+  }
+  return n;
+}
+
+task<> pooled_roundtrip(io_context *ctx) {
+  // the first one may come from operator new, the rest reuse it.
+  EXPECT_EQ(co_await add_one(1), 2);
+  auto idle = idle_frames();
+  EXPECT_GE(idle, 1);
+  EXPECT_EQ(co_await sum(100), 5050);
+  EXPECT_EQ(idle_frames(), idle + 1);
+  EXPECT_EQ(co_await hello(), "hello");
+  ctx->stop();
+}
+}  // namespace
+
+TEST(FrameAllocator, SizeClasses) {
+  EXPECT_EQ(frame_lists::class_of(1), 0);
+  EXPECT_EQ(frame_lists::class_of(64), 0);
+  EXPECT_EQ(frame_lists::class_of(65), 1);
+  EXPECT_EQ(frame_lists::size_of(frame_lists::CLASSES - 1), FRAME_ALLOCATOR_MAX_CLASS);
+}
+
+TEST(FrameAllocator, FramesAreRecycled) {
+  auto a = add_one(1);
+  auto idle = idle_frames();
+  {
+    auto b = add_one(2);
+  }
+  EXPECT_EQ(idle_frames(), idle + 1);
+  auto b = add_one(3);
+  EXPECT_EQ(idle_frames(), idle);
+}
+
+TEST(FrameAllocator, TasksOnContext) {
+  io_context ctx;
+  ctx.schedule(pooled_roundtrip(&ctx));
+  ctx.run();
+}
+
+TEST(FrameAllocator, FreedOnAnotherThread) {
+  auto idle = idle_frames();
+  task<int, pooled_frames> made;
+  std::thread t{[&made] { made = add_one(1); }};
+  t.join();
+  made = {};
+  // it joins the freelist of this thread.
+  EXPECT_EQ(idle_frames(), idle + 1);
+}
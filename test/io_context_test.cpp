@@ -56,8 +56,12 @@ task<> sleep_for(std::chrono::microseconds t) {
   }
 }
 
-TEST(Timeout, sleep3s) {
+/// every timer test runs with the deadline passed to io_uring_enter and with the IORING_OP_TIMEOUT fallback.
+class Timeout : public ::testing::TestWithParam<bool> {};
+
+TEST_P(Timeout, sleep3s) {
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, sleep_for(3s));
@@ -69,8 +73,9 @@ TEST(Timeout, sleep3s) {
   });
   ctx.run();
 }
-TEST(Timeout, sleep100us) {
+TEST_P(Timeout, sleep100us) {
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, sleep_for(100us));
@@ -83,8 +88,9 @@ TEST(Timeout, sleep100us) {
   ctx.run();
 }
 
-TEST(Timeout, multisleep) {
+TEST_P(Timeout, multisleep) {
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, []() -> task<> {
@@ -132,10 +138,11 @@ task<> sleep_for2(std::chrono::microseconds t) {
   }
   counter++;
 }
-TEST(Timeout, manyTimers) {
+TEST_P(Timeout, manyTimers) {
   counter = 0;
   order = 0;
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, sleep_for2(1s));
@@ -177,10 +184,11 @@ TEST(Timeout, manyTimers) {
   order = 0;
 }
 
-TEST(Timeout, tremendousTimers) {
+TEST_P(Timeout, tremendousTimers) {
   counter = 0;
   order = 0;
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   for (auto i = 0; i < 100; i++) {
@@ -199,8 +207,9 @@ TEST(Timeout, tremendousTimers) {
   counter = 0;
   order = 0;
 }
-TEST(Timeout, recursiveTimers) {
+TEST_P(Timeout, recursiveTimers) {
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, []() -> task<> {
@@ -228,8 +237,9 @@ task<> sleep_for_accurate(std::chrono::microseconds t) {
     EXPECT_LE(static_cast<double>(std::abs(ti - pass)) / ti, 0.1);
   }
 }
-TEST(Timeout, DirectTimeout) {
+TEST_P(Timeout, DirectTimeout) {
   io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
   auto exec = ctx.as_executor();
   using namespace std::chrono_literals;
   schedule(exec, []() -> task<> {
@@ -243,3 +253,174 @@ TEST(Timeout, DirectTimeout) {
   });
   ctx.run();
 }
+TEST_P(Timeout, CancelTimeout) {
+  io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
+  using namespace std::chrono_literals;
+  int resumed = 0;
+  ctx.schedule([](io_context *ioc, int &resumed) -> task<> {
+    detail::timeout_awaitable t{100ms, *ioc};
+    // cancel it before it fires, from another coroutine of the loop.
+    ioc->execute([](detail::timeout_awaitable &t) -> task<> {
+      co_await timeout(10ms);
+      EXPECT_TRUE(t.cancel());
+      EXPECT_FALSE(t.cancel());
+    }(t));
+    auto before = system_clock::now();
+    EXPECT_FALSE(co_await t);
+    EXPECT_LT(system_clock::now() - before, 90ms);
+    resumed++;
+    // the node is gone, nothing resumes us again.
+    co_await timeout(200ms);
+    ioc->stop();
+  }(&ctx, resumed));
+  ctx.run();
+  EXPECT_EQ(resumed, 1);
+}
+TEST_P(Timeout, WithTimeout) {
+  io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
+  using namespace std::chrono_literals;
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  ctx.schedule([](io_context *ioc, int rfd, int wfd) -> task<> {
+    char buf[8];
+    // nothing to read, the timer wins.
+    auto before = system_clock::now();
+    EXPECT_EQ(co_await with_timeout(ioc->read(rfd, buf, sizeof(buf), 0), 50ms), -ETIME);
+    EXPECT_GE(system_clock::now() - before, 45ms);
+    // the io wins, the timer is removed.
+    EXPECT_EQ(::write(wfd, "ping", 4), 4);
+    before = system_clock::now();
+    EXPECT_EQ(co_await with_timeout(ioc->read(rfd, buf, sizeof(buf), 0), 5s), 4);
+    EXPECT_LT(system_clock::now() - before, 1s);
+    ioc->stop();
+  }(&ctx, fds[0], fds[1]));
+  ctx.run();
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+TEST_P(Timeout, CancelInFlight) {
+  io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
+  using namespace std::chrono_literals;
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+  ctx.schedule([](io_context *ioc, int rfd, int wfd) -> task<> {
+    char buf[8];
+    auto op = ioc->read(rfd, buf, sizeof(buf), 0);
+    // not co_awaited yet.
+    EXPECT_FALSE(op.cancel());
+    co_spawn([](detail::io_awaitable *op) -> task<> {
+      co_await timeout(20ms);
+      EXPECT_TRUE(op->in_flight());
+      EXPECT_TRUE(op->cancel());
+    }(&op));
+    EXPECT_EQ(co_await op, -ECANCELED);
+    EXPECT_FALSE(op.in_flight());
+    EXPECT_FALSE(op.cancel());
+    // the pipe is still fine.
+    EXPECT_EQ(::write(wfd, "ping", 4), 4);
+    EXPECT_EQ(co_await ioc->read(rfd, buf, sizeof(buf), 0), 4);
+    ioc->stop();
+  }(&ctx, fds[0], fds[1]));
+  ctx.run();
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+TEST_P(Timeout, LoopTime) {
+  io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
+  using namespace std::chrono_literals;
+  ctx.schedule([](io_context *ioc) -> task<> {
+    // cached, no clock read in between.
+    auto t0 = ioc->loop_time();
+    volatile long spin = 0;
+    for (int i = 0; i < 1000000; i++) {
+      spin = spin + i;
+    }
+    EXPECT_EQ(ioc->loop_time(), t0);
+    co_await timeout(20ms);
+    EXPECT_GE(ioc->loop_time() - t0, 20ms);
+    ioc->stop();
+  }(&ctx));
+  ctx.run();
+}
+TEST_P(Timeout, SqesPerTimer) {
+  io_context ctx;
+  ctx.set_timer_in_enter(GetParam());
+  if (GetParam() && !ctx.timer_in_enter()) {
+    GTEST_SKIP() << "no IORING_FEAT_EXT_ARG before 5.11";
+  }
+  using namespace std::chrono_literals;
+  unsigned sqes = 0;
+  ctx.schedule([](io_context *ioc, unsigned *sqes) -> task<> {
+    // the eventfd read of the wakeup by schedule() is re-armed by now.
+    co_await ioc->yield();
+    auto before = ioc->get_ring_handle().sq.sqe_tail;
+    int woke = 0;
+    for (int i = 1; i <= 8; i++) {
+      co_spawn([](std::chrono::milliseconds t, int *woke) -> task<> {
+        co_await timeout(t);
+        ++*woke;
+      }(i * 2ms, &woke));
+    }
+    co_await timeout(30ms);
+    EXPECT_EQ(woke, 8);
+    *sqes = ioc->get_ring_handle().sq.sqe_tail - before;
+    ioc->stop();
+  }(&ctx, &sqes));
+  ctx.run();
+  if (GetParam()) {
+    // the deadlines go with io_uring_enter.
+    EXPECT_EQ(sqes, 0);
+  } else {
+    // a IORING_OP_TIMEOUT per expiration at least.
+    EXPECT_GE(sqes, 8);
+  }
+}
+INSTANTIATE_TEST_SUITE_P(TimerModes, Timeout, ::testing::Values(true, false),
+                         [](const ::testing::TestParamInfo<bool> &info) {
+                           return info.param ? "InEnter" : "TimeoutSqe";
+                         });
+TEST(Reaping, BatchedReapsOverflow) {
+  // a CQ of 8 entries, 16 nops, 8 of them go to the overflow backlog of the kernel.
+  detail::io_uring_context ring{4};
+  auto &r = ring.get_ring_handle();
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 4; i++) {
+      auto sqe = io_uring_get_sqe(&r);
+      ASSERT_NE(sqe, nullptr);
+      io_uring_prep_nop(sqe);
+      io_uring_sqe_set_data(sqe, nullptr);
+    }
+    ASSERT_EQ(io_uring_submit_and_wait(&r, 4), 4);
+  }
+  ring.set_batched_reaping(true);
+  ring.handle_completions();
+  auto &st = ring.reap_stats();
+  if (ring.get_ring_handle().features & IORING_FEAT_NODROP) {
+    EXPECT_EQ(st.overflow_backlogged, 1);
+    // peek_batch_cqe flushes the backlog.
+    EXPECT_EQ(st.cqes, 16);
+  } else {
+    EXPECT_EQ(st.overflow_dropped, 8);
+  }
+  EXPECT_EQ(io_uring_cq_ready(&r), 0);
+}
+TEST(Reaping, BatchedResumesAll) {
+  io_context ctx;
+  ctx.set_batched_reaping(true);
+  ctx.schedule([](io_context *ioc) -> task<> {
+    // more than one batch in a round.
+    std::vector<task<int>> nops;
+    for (int i = 0; i < 200; i++) {
+      nops.push_back([](io_context *ioc) -> task<int> { co_return co_await ioc->yield(); }(ioc));
+    }
+    auto res = co_await when_all(std::move(nops));
+    EXPECT_EQ(res.size(), 200);
+    EXPECT_GE(ioc->reap_stats().cqes, 200);
+    ioc->stop();
+  }(&ctx));
+  ctx.run();
+}
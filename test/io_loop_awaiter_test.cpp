@@ -0,0 +1,122 @@
+// io_loop_awaiter_test.cpp
+// Created by PanJunzhong on 2022/5/28.
+//
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_reader.hpp"
+#include "coring/socket_writer.hpp"
+#include "coring/timeout.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+using namespace std::chrono_literals;
+
+namespace {
+task<> short_writes_go_on(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  int small = 4096;
+  ::setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+  tcp::connection conn{fds[0]};
+  // far more than the socket takes at once, a.k.a. many rounds inside one awaiter.
+  std::string all(1 << 20, 'a');
+  for (size_t i = 0; i < all.size(); i++) {
+    all[i] = static_cast<char>('a' + i % 26);
+  }
+  std::string got;
+  std::thread peer{[fd = fds[1], &got, n = all.size()] {
+    char b[8192];
+    while (got.size() < n) {
+      auto r = ::recv(fd, b, sizeof(b), 0);
+      if (r <= 0) {
+        break;
+      }
+      got.append(b, r);
+    }
+  }};
+  flex_buffer buf{};
+  buf.push_back(all.data(), all.size());
+  co_await write_all(&conn, &buf);
+  EXPECT_EQ(buf.readable(), 0);
+  // nothing to write, it doesn't suspend at all.
+  co_await write_all(&conn, &buf);
+  peer.join();
+  EXPECT_EQ(got, all);
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> some_and_certain(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  flex_buffer out{};
+  out.push_back_string("0123456789");
+  EXPECT_EQ(co_await write_some(&conn, &out), 10);
+  flex_buffer in{};
+  ::send(fds[1], "abc", 3, 0);
+  EXPECT_EQ(co_await read_some(&conn, &in), 3);
+  std::thread peer{[fd = fds[1]] {
+    ::send(fd, "de", 2, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ::send(fd, "fgh", 3, 0);
+  }};
+  co_await read_certain(&conn, &in, 8);
+  EXPECT_EQ(in.readable_view(), "abcdefgh");
+  peer.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> timed_rounds(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  flex_buffer in{};
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_THROW(co_await read_some(&conn, &in, 20ms), std::system_error);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+  char b[4];
+  EXPECT_EQ(co_await conn.recv_some(b, sizeof(b), 10ms), -ECANCELED);
+  ::send(fds[1], "hello\n", 6, 0);
+  EXPECT_EQ(co_await read_line(&conn, &in, 1s), 6);
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> cancel_a_read(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  flex_buffer in{};
+  auto reading = read_some(&conn, &in);
+  co_spawn([](decltype(reading) *r) -> task<> {
+    co_await timeout(10ms);
+    EXPECT_TRUE(r->cancel());
+  }(&reading));
+  try {
+    co_await reading;
+    ADD_FAILURE() << "it should be cancelled";
+  } catch (std::system_error &e) {
+    EXPECT_EQ(e.code().value(), ECANCELED);
+  }
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+void run(task<> (*f)(io_context *)) {
+  io_context ctx;
+  ctx.schedule(f(&ctx));
+  ctx.run();
+}
+}  // namespace
+
+TEST(IoLoopAwaiter, ShortWritesGoOn) { run(short_writes_go_on); }
+
+TEST(IoLoopAwaiter, SomeAndCertain) { run(some_and_certain); }
+
+TEST(IoLoopAwaiter, TimedRounds) { run(timed_rounds); }
+
+TEST(IoLoopAwaiter, Cancel) { run(cancel_a_read); }
@@ -0,0 +1,126 @@
+// line_reader_test.cpp
+// Created by PanJunzhong on 2022/5/24.
+//
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_reader.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+namespace {
+/// send the segments from another thread, with a pause in between so that every one is a separate recv.
+std::thread send_slowly(int fd, std::vector<std::string> segments, bool close_at_end = false) {
+  return std::thread{[fd, segments = std::move(segments), close_at_end] {
+    for (auto &s : segments) {
+      ::send(fd, s.data(), s.size(), 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    if (close_at_end) {
+      ::shutdown(fd, SHUT_WR);
+    }
+  }};
+}
+
+std::string_view take(flex_buffer *buf, int n) {
+  std::string_view line{buf->front(), static_cast<size_t>(n)};
+  buf->has_read(n);
+  return line;
+}
+
+task<> crlf_across_segments(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  // the '\r' and '\n' of the request line come in different segments.
+  auto t = send_slowly(fds[1], {"GET / HT", "TP/1.1\r", "\nHost: x\r\n\r", "\n"});
+  flex_buffer buf{16};
+  line_reader reader{&buf, line_reader<flex_buffer>::crlf};
+  EXPECT_EQ(take(&buf, co_await reader.read(&conn)), "GET / HTTP/1.1\r\n");
+  EXPECT_EQ(reader.scanned(), 0);
+  EXPECT_EQ(take(&buf, co_await reader.read(&conn)), "Host: x\r\n");
+  EXPECT_EQ(take(&buf, co_await reader.read(&conn)), "\r\n");
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> long_line_grows_buffer(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::vector<std::string> segments(100, std::string(100, 'a'));
+  segments.back().back() = '\n';
+  segments.emplace_back("next\n");
+  auto t = send_slowly(fds[1], std::move(segments));
+  flex_buffer buf{};
+  auto n = co_await read_line(&conn, &buf);
+  EXPECT_EQ(n, 10000);
+  EXPECT_GE(buf.capacity(), 10000);
+  EXPECT_EQ(take(&buf, n), std::string(9999, 'a') + "\n");
+  EXPECT_EQ(take(&buf, co_await read_line(&conn, &buf)), "next\n");
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> line_too_long(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  auto t = send_slowly(fds[1], {std::string(200, 'a'), std::string(200, 'a'), "\n"});
+  flex_buffer buf{};
+  line_reader reader{&buf, line_reader<flex_buffer>::lf, 256};
+  EXPECT_THROW(co_await reader.read(&conn), std::length_error);
+  // it never grows far beyond the bound.
+  EXPECT_LE(buf.capacity(), 2 * 256);
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> eof_in_a_line(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  auto t = send_slowly(fds[1], {"half a li"}, true);
+  flex_buffer buf{};
+  EXPECT_THROW(co_await read_crlf_line(&conn, &buf), coring::eof_error);
+  EXPECT_EQ(buf.readable(), 9);
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> certain_bytes(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  auto t = send_slowly(fds[1], {"0123", "4567", "89"});
+  flex_buffer buf{4};
+  co_await read_certain(&conn, &buf, 10);
+  EXPECT_EQ(std::string_view(buf.front(), buf.readable()), "0123456789");
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+void run(task<> (*f)(io_context *)) {
+  io_context ctx;
+  ctx.schedule(f(&ctx));
+  ctx.run();
+}
+}  // namespace
+
+TEST(LineReader, CrlfAcrossSegments) { run(crlf_across_segments); }
+
+TEST(LineReader, LongLineGrowsBuffer) { run(long_line_grows_buffer); }
+
+TEST(LineReader, LineTooLong) { run(line_too_long); }
+
+TEST(LineReader, EofInALine) { run(eof_in_a_line); }
+
+TEST(LineReader, ReadCertainCountsBytes) { run(certain_bytes); }
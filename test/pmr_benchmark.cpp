@@ -6,7 +6,9 @@
 #include <vector>
 #include <array>
 #include <list>
+#include <deque>
 #include <coring/detail/skiplist_map.hpp>
+#include <coring/detail/timing_wheel.hpp>
 #include <map>
 using namespace std;
 constexpr int SYSTEM_SIZE = 100;
@@ -26,7 +28,63 @@ struct ITests {
   virtual void random_ops() = 0;
   virtual void access_ops() = 0;
   virtual void pop_ops() = 0;
+  virtual void timer_ops() = 0;
 };
+
+// Timer-shaped workload: every tick each timer gets some I/O timeouts armed (mostly short, a few long),
+// most of them are cancelled a few ticks later (the I/O completed in time), and the expired ones are popped.
+constexpr int TIMER_TICKS = 2000;
+constexpr int TIMER_ARM_PER_TICK = 16;
+constexpr int TIMER_CANCEL_AFTER = 8;
+struct TimerWorkload {
+  unsigned seed = 12345;
+  unsigned next() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+  }
+  int delay() {
+    auto r = next();
+    // 1 of 64 are long ones (keep-alive like), others are I/O deadlines.
+    return (r & 63) == 0 ? 100000 + static_cast<int>(r % 1000000) : 100 + static_cast<int>(r % 5000);
+  }
+  bool cancel() { return next() % 10 != 0; }
+};
+
+/// \param arm (sub, key, val) -> handle
+/// \param cancel (sub, key, handle)
+/// \param pop (sub, now) -> popped count
+template <typename Sub, typename Arm, typename Cancel, typename Pop>
+void run_timer_workload(std::vector<std::unique_ptr<Sub>> &subs, Arm &&arm, Cancel &&cancel, Pop &&pop) {
+  using handle_t = decltype(arm(*subs[0], 0, 0));
+  struct pending {
+    int tick;
+    int key;
+    handle_t h;
+  };
+  TimerWorkload w{};
+  std::vector<std::deque<pending>> recent(subs.size());
+  long armed = 0, cancelled = 0, popped = 0;
+  for (int now = 1; now <= TIMER_TICKS; now++) {
+    for (size_t i = 0; i < subs.size(); i++) {
+      auto &sub = *subs[i];
+      for (int k = 0; k < TIMER_ARM_PER_TICK; k++) {
+        auto key = now + w.delay();
+        recent[i].push_back(pending{now, key, arm(sub, key, k)});
+        armed++;
+      }
+      while (!recent[i].empty() && recent[i].front().tick + TIMER_CANCEL_AFTER <= now) {
+        auto &p = recent[i].front();
+        if (w.cancel()) {
+          cancel(sub, p.key, p.h);
+          cancelled++;
+        }
+        recent[i].pop_front();
+      }
+      popped += pop(sub, now);
+    }
+  }
+  cout << "armed " << armed << ", cancelled " << cancelled << ", popped " << popped << endl;
+}
 template <typename Container>
 struct SystemBase : ITests {
   std::vector<std::unique_ptr<Container>> subs{};
@@ -161,6 +219,21 @@ struct MapTestsBase : SystemBase<MapType> {
       }
     }
   }
+  void timer_ops() override {
+    run_timer_workload(
+        Find::subs, [](MapType &m, int key, int val) { return m.emplace(key, val); },
+        [](MapType &m, int, typename MapType::iterator it) { m.erase(it); },
+        [](MapType &m, int now) {
+          auto last = m.upper_bound(now);
+          long cnt = 0;
+          for (auto it = m.begin(); it != last; it++) {
+            it->second = -1;  // simulate some thing
+            cnt++;
+          }
+          m.erase(m.begin(), last);
+          return cnt;
+        });
+  }
 };
 
 struct MapSystem : MapTestsBase<std::multimap<int, int>> {
@@ -284,6 +357,24 @@ struct SkipTestsBase : SystemBase<SkipType> {
       }
     }
   }
+  void timer_ops() override {
+    // no handle, cancel by key, it may remove another one with the same key, which is fine in a benchmark.
+    run_timer_workload(
+        Find::subs,
+        [](SkipType &m, int key, int val) {
+          m.emplace(key, val);
+          return 0;
+        },
+        [](SkipType &m, int key, int) { m.erase_one(key); },
+        [](SkipType &m, int now) {
+          long cnt = 0;
+          m.do_less_eq_then_pop(now, [&cnt](int &a) -> void {
+            a = -1;
+            cnt++;
+          });
+          return cnt;
+        });
+  }
 };
 struct SkipSystem : SkipTestsBase<coring::experimental::skiplist_map<int, int>> {
   SkipSystem(int scale = SYSTEM_SIZE) {
@@ -332,6 +423,31 @@ struct PmrSkipSystem
   }
 };
 
+struct WheelSystem : SystemBase<coring::detail::timing_wheel<int, int>> {
+  using wheel_t = coring::detail::timing_wheel<int, int>;
+  using Find = SystemBase<wheel_t>;
+  WheelSystem(int scale) {
+    std::cout << "wheel" << std::endl;
+    Find::subs.resize(scale);
+    for (int i = 0; i < scale; i++) {
+      subs[i] = std::make_unique<wheel_t>();
+    }
+  }
+  // the wheel is not an ordered map, only timer_ops make sense.
+  void sequential_ops() override { cout << "wheel supports timer ops only" << endl; }
+  void random_ops() override { sequential_ops(); }
+  void access_ops() override { sequential_ops(); }
+  void pop_ops() override { sequential_ops(); }
+  void timer_ops() override {
+    run_timer_workload(
+        Find::subs, [](wheel_t &m, int key, int val) { return m.emplace(key, val); },
+        [](wheel_t &m, int, wheel_t::handle_t h) { m.erase(h); },
+        [](wheel_t &m, int now) {
+          return static_cast<long>(m.do_less_eq_then_pop(now, [](int &a) -> void { a = -1; }));
+        });
+  }
+};
+
 char get(char **argv, int nd) { return argv[nd][0]; }
 bool match(const char *c, char ch) { return c[0] == ch; }
 constexpr int DS = 1;
@@ -340,11 +456,14 @@ constexpr int OP = 3;
 int main(int argc, char **argv) {
   if (argc < 4) {
     std::cout << "`./pmr map non-pmr sequential` to run map + non-pmr + sequential_ops" << std::endl
-              << "`./pmr skip pmr random` to run skiplist_map + pmr + random_ops" << std::endl;
+              << "`./pmr skip pmr random` to run skiplist_map + pmr + random_ops" << std::endl
+              << "`./pmr wheel non-pmr timer` to run timing_wheel + timer_ops (wheel supports timer only)" << std::endl;
     exit(0);
   }
   ITests *global_itest = nullptr;
-  if (match("map", get(argv, DS))) {
+  if (match("wheel", get(argv, DS))) {
+    global_itest = new WheelSystem(128);
+  } else if (match("map", get(argv, DS))) {
     if (match("pmr", get(argv, PMR))) {
       global_itest = new PmrMapSystem(128);
     } else {
@@ -370,6 +489,9 @@ int main(int argc, char **argv) {
   } else if (match("pop", get(argv, OP))) {
     std::cout << ".pop" << std::endl;
     global_itest->pop_ops();
+  } else if (match("timer", get(argv, OP))) {
+    std::cout << ".timer" << std::endl;
+    global_itest->timer_ops();
   }
   return 0;
 }
\ No newline at end of file
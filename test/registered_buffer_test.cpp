@@ -0,0 +1,112 @@
+// registered_buffer_test.cpp
+// Created by PanJunzhong on 2022/5/19.
+//
+#include "coring/registered_buffer_arena.hpp"
+#include "coring/file.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_writer.hpp"
+#include <cstdlib>
+#include <string>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+namespace {
+/// opcode of the latest sqe the ring has taken.
+__u8 last_opcode(io_context &ctx) {
+  auto &sq = ctx.get_ring_handle().sq;
+  return sq.sqes[(sq.sqe_tail - 1) & sq.ring_mask].opcode;
+}
+}  // namespace
+
+TEST(RegisteredBuffer, AllocateAndRecycle) {
+  io_context ctx;
+  registered_buffer_arena arena{&ctx, 4096, 4};
+  EXPECT_EQ(ctx.buffer_arena(), &arena);
+  EXPECT_THROW(registered_buffer_arena(&ctx, 4096, 1), std::runtime_error);
+  {
+    std::vector<registered_buffer> bufs;
+    for (int i = 0; i < 4; i++) {
+      bufs.push_back(arena.allocate());
+      EXPECT_EQ(bufs.back().writable(), 4096);
+      EXPECT_EQ(arena.index_of(bufs.back().data(), 4096), bufs.back().buf_index());
+    }
+    EXPECT_THROW(arena.allocate(), std::runtime_error);
+    // crossing the end of a slice is not inside a registered buffer.
+    EXPECT_EQ(arena.index_of(bufs[0].data() + 1, 4096), -1);
+    char outside[16];
+    EXPECT_EQ(arena.index_of(outside, sizeof(outside)), -1);
+  }
+  EXPECT_EQ(arena.available(), 4);
+}
+
+namespace {
+task<> file_round_trip(io_context *ctx, registered_buffer_arena *arena, const char *path) {
+  auto f = co_await openat<empty_file_t>(path, O_RDWR);
+  auto out = arena->allocate();
+  std::string msg = "registered buffers are pinned once";
+  out.push_back(msg.data(), msg.size());
+  auto w = f.write(out.front(), out.readable(), 0);
+  EXPECT_EQ(last_opcode(*ctx), IORING_OP_WRITE_FIXED);
+  EXPECT_EQ(co_await w, static_cast<int>(msg.size()));
+  auto in = arena->allocate();
+  auto r = f.read(in.back(), in.writable(), 0);
+  EXPECT_EQ(last_opcode(*ctx), IORING_OP_READ_FIXED);
+  auto n = co_await r;
+  EXPECT_EQ(n, static_cast<int>(msg.size()));
+  in.has_written(n);
+  EXPECT_EQ(in.readable_view(), msg);
+  // memory out of the arena takes the plain path.
+  char plain[8];
+  auto p = f.read(plain, sizeof(plain), 0);
+  EXPECT_EQ(last_opcode(*ctx), IORING_OP_READ);
+  co_await p;
+  co_await f.close();
+  ctx->stop();
+}
+
+task<> socket_write_all(io_context *ctx, registered_buffer_arena *arena) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  auto out = arena->allocate();
+  out.push_back("hello", 5);
+  // write_all goes through send_some.
+  auto w = conn.send_some(out.front(), 2);
+  EXPECT_EQ(last_opcode(*ctx), IORING_OP_WRITE_FIXED);
+  out.has_read(co_await w);
+  co_await write_all(&conn, &out);
+  char got[8]{};
+  EXPECT_EQ(::recv(fds[1], got, sizeof(got), 0), 5);
+  EXPECT_EQ(std::string_view(got, 5), "hello");
+  EXPECT_EQ(::send(fds[1], "world", 5, 0), 5);
+  auto in = arena->allocate();
+  auto r = conn.recv_some(in.back(), in.writable());
+  EXPECT_EQ(last_opcode(*ctx), IORING_OP_READ_FIXED);
+  auto n = co_await r;
+  EXPECT_EQ(n, 5);
+  in.has_written(n);
+  EXPECT_EQ(in.readable_view(), "world");
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(RegisteredBuffer, FileReadWriteFixed) {
+  io_context ctx;
+  registered_buffer_arena arena{&ctx, 4096, 2};
+  char path[] = "/tmp/coring_registered_XXXXXX";
+  int fd = ::mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ::close(fd);
+  ctx.schedule(file_round_trip(&ctx, &arena, path));
+  ctx.run();
+  ::unlink(path);
+}
+
+TEST(RegisteredBuffer, SocketWriteAllFixed) {
+  io_context ctx;
+  registered_buffer_arena arena{&ctx, 4096, 2};
+  ctx.schedule(socket_write_all(&ctx, &arena));
+  ctx.run();
+}
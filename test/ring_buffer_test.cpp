@@ -0,0 +1,96 @@
+// ring_buffer_test.cpp
+// Created by PanJunzhong on 2022/5/25.
+//
+#include "coring/ring_buffer.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_reader.hpp"
+#include "coring/socket_writer.hpp"
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+TEST(RingBuffer, WrapsWithoutMoving) {
+  ring_buffer buf{4096};
+  ASSERT_EQ(buf.size(), 4096);
+  const char *base = buf.data();
+  std::string a(3000, 'a');
+  std::string b(3000, 'b');
+  buf.push_back(a.data(), a.size());
+  buf.has_read(2500);
+  // 2500 free at the head, 1096 at the tail: the write crosses the end of the ring.
+  EXPECT_EQ(buf.writable(), 3596);
+  buf.push_back(b.data(), b.size());
+  EXPECT_EQ(buf.data(), base);
+  EXPECT_EQ(buf.readable(), 3500);
+  EXPECT_EQ(buf.readable_view(), std::string(500, 'a') + b);
+  // the wrapped part is seen at the head of the ring as well.
+  EXPECT_EQ(std::string_view(buf.data(), 1904), std::string(1904, 'b'));
+  buf.has_read(1000);
+  // the read index is back to the first half.
+  EXPECT_LT(buf.front(), buf.data() + buf.size());
+  EXPECT_EQ(buf.readable_view(), std::string(2500, 'b'));
+  buf.push_back_int(uint32_t{0x01020304});
+  buf.has_read(2500);
+  EXPECT_EQ(buf.pop_int<uint32_t>(), 0x01020304);
+  EXPECT_EQ(buf.readable(), 0);
+}
+
+TEST(RingBuffer, GrowsKeepingBytes) {
+  ring_buffer buf{4096};
+  std::string a(4000, 'a');
+  buf.push_back(a.data(), a.size());
+  buf.has_read(3000);
+  buf.push_back_string("0123456789");
+  std::string b(5000, 'b');
+  buf.push_back(b.data(), b.size());
+  EXPECT_GE(buf.size(), 8192);
+  EXPECT_EQ(buf.readable_view(), std::string(1000, 'a') + "0123456789" + b);
+  EXPECT_EQ(buf.find('0'), buf.front() + 1000);
+}
+
+namespace {
+task<> pipelined_lines(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  // 2000 lines of ~50 bytes wrap a 4KB ring many times.
+  std::string all;
+  for (int i = 0; i < 2000; i++) {
+    all += "line " + std::to_string(i) + " " + std::string(40, 'x') + "\r\n";
+  }
+  std::thread peer{[fd = fds[1], &all] {
+    for (size_t off = 0; off < all.size(); off += 1000) {
+      ::send(fd, all.data() + off, std::min<size_t>(1000, all.size() - off), 0);
+    }
+  }};
+  ring_buffer in{4096};
+  auto base = in.data();
+  line_reader reader{&in, line_reader<ring_buffer>::crlf};
+  ring_buffer out{4096};
+  std::string expected;
+  for (int i = 0; i < 2000; i++) {
+    auto n = co_await reader.read(&conn);
+    expected = "line " + std::to_string(i) + " " + std::string(40, 'x') + "\r\n";
+    EXPECT_EQ(in.readable_view(n), expected);
+    // echo it back through socket_writer.
+    out.push_back(in.front(), n);
+    in.has_read(n);
+    co_await write_all(&conn, &out);
+    char echoed[64];
+    EXPECT_EQ(::recv(fds[1], echoed, sizeof(echoed), 0), static_cast<ssize_t>(n));
+  }
+  // never reallocated, a.k.a. no moving at all.
+  EXPECT_EQ(in.data(), base);
+  peer.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(RingBuffer, SocketReaderWriter) {
+  io_context ctx;
+  ctx.schedule(pipelined_lines(&ctx));
+  ctx.run();
+}
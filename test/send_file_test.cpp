@@ -0,0 +1,128 @@
+// send_file_test.cpp
+// Created by PanJunzhong on 2022/5/22.
+//
+#include "coring/file.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_writer.hpp"
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+TEST(SendFile, PipePoolRecycles) {
+  detail::pipe_pool pool{1};
+  auto p = pool.acquire();
+  EXPECT_GE(p.capacity, 4096);
+  auto q = pool.acquire();
+  pool.release(p, true);
+  // over max_idle, closed.
+  pool.release(q, true);
+  EXPECT_EQ(pool.idle(), 1);
+  auto r = pool.acquire();
+  EXPECT_EQ(r.rd, p.rd);
+  EXPECT_EQ(pool.idle(), 0);
+  // it may hold something, closed.
+  pool.release(r, false);
+  EXPECT_EQ(pool.idle(), 0);
+}
+
+namespace {
+struct temp_file {
+  explicit temp_file(size_t n) {
+    int fd = ::mkstemp(path);
+    content.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      content[i] = static_cast<char>('a' + i % 23);
+    }
+    EXPECT_EQ(::write(fd, content.data(), n), static_cast<ssize_t>(n));
+    ::close(fd);
+  }
+  ~temp_file() { ::unlink(path); }
+  char path[32] = "/tmp/coring_send_file_XXXXXX";
+  std::string content;
+};
+
+/// read n bytes (or until eof) from fd on another thread, the socket buffer is smaller than the files.
+std::thread receive(int fd, size_t n, std::string *got) {
+  return std::thread{[fd, n, got] {
+    char buf[64 * 1024];
+    while (got->size() < n) {
+      auto r = ::recv(fd, buf, sizeof(buf), 0);
+      if (r <= 0) {
+        break;
+      }
+      got->append(buf, r);
+    }
+  }};
+}
+
+task<> send_part(io_context *ctx, const temp_file *tf, bool fixed) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  if (fixed) {
+    EXPECT_TRUE(conn.use_fixed_file());
+  }
+  auto file = co_await openat<empty_file_t>(tf->path, O_RDONLY);
+  off_t off = 1000;
+  size_t len = tf->content.size() - 3000;
+  std::string got;
+  auto t = receive(fds[1], len, &got);
+  co_await send_file(&conn, &file, off, len);
+  t.join();
+  EXPECT_EQ(got.size(), len);
+  EXPECT_TRUE(got == std::string_view(tf->content).substr(off, len));
+  EXPECT_EQ(ctx->pipes().idle(), 1);
+  co_await file.close();
+  co_await conn.close();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> send_past_eof(io_context *ctx, const temp_file *tf) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  auto file = co_await openat<empty_file_t>(tf->path, O_RDONLY);
+  std::string got;
+  auto t = receive(fds[1], tf->content.size(), &got);
+  bool eof = false;
+  try {
+    co_await send_file(&conn, &file, 0, tf->content.size() * 2);
+  } catch (coring::eof_error &e) {
+    eof = true;
+  }
+  t.join();
+  EXPECT_TRUE(eof);
+  // what the file has is sent anyway.
+  EXPECT_TRUE(got == tf->content);
+  EXPECT_EQ(ctx->pipes().idle(), 1);
+  co_await file.close();
+  co_await conn.close();
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(SendFile, SpliceToSocket) {
+  temp_file tf{3 * SPLICE_PIPE_SIZE + 12345};
+  io_context ctx;
+  ctx.schedule(send_part(&ctx, &tf, false));
+  ctx.run();
+}
+
+TEST(SendFile, SpliceToFixedSocket) {
+  temp_file tf{1024 * 1024};
+  io_context ctx;
+  ctx.schedule(send_part(&ctx, &tf, true));
+  ctx.run();
+}
+
+TEST(SendFile, FileShorterThanLength) {
+  temp_file tf{10000};
+  io_context ctx;
+  ctx.schedule(send_past_eof(&ctx, &tf));
+  ctx.run();
+}
@@ -0,0 +1,102 @@
+// send_zc_test.cpp
+// Created by PanJunzhong on 2022/5/20.
+//
+#include "coring/acceptor.hpp"
+#include "coring/socket_writer.hpp"
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <gtest/gtest.h>
+using namespace coring;
+
+namespace {
+constexpr size_t BODY = 1 << 20;
+
+uint16_t bound_port(int listenfd) {
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  ::getsockname(listenfd, reinterpret_cast<sockaddr *>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+int connect_loopback(uint16_t port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  EXPECT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+  return fd;
+}
+
+/// read everything until EOF on another thread.
+std::string drain(int fd) {
+  std::string got;
+  char tmp[65536];
+  ssize_t n;
+  while ((n = ::recv(fd, tmp, sizeof(tmp), 0)) > 0) {
+    got.append(tmp, static_cast<size_t>(n));
+  }
+  return got;
+}
+
+std::string make_body() {
+  std::string body(BODY, '\0');
+  for (size_t i = 0; i < BODY; i++) {
+    body[i] = static_cast<char>('a' + i % 26);
+  }
+  return body;
+}
+
+task<> send_body_zc(io_context *ctx, std::string *got) {
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  int client = connect_loopback(bound_port(acceptor.fd()));
+  std::thread reader{[client, got] { *got = drain(client); }};
+  {
+    auto conn = co_await acceptor.accept();
+    flex_buffer body(0);
+    body.push_back_string(make_body());
+    co_await write_all_zc(&conn, &body);
+    EXPECT_EQ(body.readable(), 0);
+    co_await conn.close();
+  }
+  reader.join();
+  ::close(client);
+  ctx->stop();
+}
+
+/// unix sockets don't do zero-copy (-EOPNOTSUPP), it goes on with plain sends.
+task<> send_body_unix(io_context *ctx, std::string *got) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::thread reader{[fd = fds[1], got] { *got = drain(fd); }};
+  {
+    tcp::connection conn{fds[0]};
+    flex_buffer body(0);
+    body.push_back_string(make_body());
+    co_await write_all_zc(&conn, &body);
+    EXPECT_EQ(body.readable(), 0);
+    co_await conn.close();
+  }
+  reader.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(SendZc, WriteAllOverLoopback) {
+  io_context ctx;
+  std::string got;
+  ctx.schedule(send_body_zc(&ctx, &got));
+  ctx.run();
+  EXPECT_EQ(got, make_body());
+}
+
+TEST(SendZc, FallbackIfNotSupported) {
+  io_context ctx;
+  std::string got;
+  ctx.schedule(send_body_unix(&ctx, &got));
+  ctx.run();
+  EXPECT_EQ(got, make_body());
+}
@@ -0,0 +1,102 @@
+// shutdown_test.cpp
+// Created by PanJunzhong on 2022/5/29.
+//
+#include "coring/acceptor.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/timeout.hpp"
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+using namespace std::chrono_literals;
+
+namespace {
+/// waits for a request that never comes, says bye when it's cancelled.
+task<> keep_alive(int fd, int *cancelled) {
+  tcp::connection conn{fd};
+  char buf[16];
+  int n = co_await conn.recv_some(buf, sizeof(buf));
+  if (n == -ECANCELED) {
+    ++*cancelled;
+    // submitted after the cancel, it's waited for.
+    char bye[] = "bye";
+    co_await conn.send_some(bye, 3);
+  }
+}
+
+task<> serve(tcp::acceptor *acceptor, bool *ended) {
+  auto fds = acceptor->accept_fd_stream();
+  for (auto it = co_await fds.begin(); it != fds.end(); co_await ++it) {
+    ::close(*it);
+  }
+  *ended = true;
+}
+
+task<> stop_later(io_context *ctx) {
+  co_await timeout(10ms);
+  ctx->stop();
+}
+
+task<> sleep_for(std::chrono::milliseconds dur, bool *woke) {
+  co_await timeout(dur);
+  *woke = true;
+}
+}  // namespace
+
+TEST(Shutdown, CancelsInFlightAndDrains) {
+  io_context ctx;
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  int peers[4][2];
+  int cancelled = 0;
+  bool ended = false;
+  for (auto &fds : peers) {
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    ctx.schedule(keep_alive(fds[0], &cancelled));
+  }
+  ctx.schedule(serve(&acceptor, &ended));
+  ctx.schedule(stop_later(&ctx));
+  ctx.run();
+  EXPECT_EQ(cancelled, 0);
+  EXPECT_TRUE(ctx.shutdown(1s));
+  EXPECT_EQ(cancelled, 4);
+  EXPECT_TRUE(ended);
+  for (auto &fds : peers) {
+    char buf[4]{};
+    EXPECT_EQ(::recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT), 3);
+    EXPECT_EQ(std::string(buf), "bye");
+    ::close(fds[1]);
+  }
+}
+
+TEST(Shutdown, WaitsForTimers) {
+  io_context ctx;
+  bool woke = false;
+  ctx.schedule(sleep_for(20ms, &woke));
+  ctx.schedule(stop_later(&ctx));
+  ctx.run();
+  EXPECT_FALSE(woke);
+  EXPECT_TRUE(ctx.shutdown(1s));
+  EXPECT_TRUE(woke);
+}
+
+TEST(Shutdown, GivesUpAtTheDeadline) {
+  io_context ctx;
+  bool woke = false;
+  ctx.schedule(sleep_for(10s, &woke));
+  ctx.schedule(stop_later(&ctx));
+  ctx.run();
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(ctx.shutdown(50ms));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+  EXPECT_FALSE(woke);
+}
+
+TEST(Shutdown, NothingToDrain) {
+  io_context ctx;
+  ctx.schedule(stop_later(&ctx));
+  ctx.run();
+  EXPECT_TRUE(ctx.shutdown(1s));
+  EXPECT_FALSE(ctx.shutting_down());
+}
@@ -0,0 +1,62 @@
+// sqpoll_benchmark.cpp
+// Created by PanJunzhong on 2022/5/29.
+//
+// io_uring_enter calls per echoed message, a ping-pong over a socketpair as echo_server's echo_loop does it,
+// with a plain ring and with a SQPOLL one (io_context::with_sqpoll), check io_uring_context::submit_stats().
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include "coring/tcp_connection.hpp"
+#include "coring/socket_reader.hpp"
+#include "coring/socket_writer.hpp"
+using namespace coring;
+constexpr int MESSAGES = 50000;
+constexpr size_t MESSAGE_LEN = 64;
+
+task<> echo(io_context *ctx, const char *name) {
+  int fds[2];
+  ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  tcp::connection conn{fds[0]};
+  std::thread peer{[fd = fds[1]] {
+    char msg[MESSAGE_LEN] = {'x'};
+    for (int i = 0; i < MESSAGES; i++) {
+      ::send(fd, msg, sizeof(msg), 0);
+      for (size_t got = 0; got < sizeof(msg);) {
+        got += ::recv(fd, msg, sizeof(msg) - got, 0);
+      }
+    }
+  }};
+  flex_buffer buf{MESSAGE_LEN * 2};
+  auto before = ctx->submit_stats();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < MESSAGES; i++) {
+    co_await read_some(&conn, &buf);
+    co_await write_all(&conn, &buf);
+  }
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  auto &after = ctx->submit_stats();
+  std::cout << name << ": " << static_cast<long>(MESSAGES / secs) << " messages/s, "
+            << static_cast<double>(after.enters - before.enters) / MESSAGES << " io_uring_enter and "
+            << static_cast<double>(after.enters_avoided - before.enters_avoided) / MESSAGES
+            << " avoided per echoed message, " << after.sq_wakeups - before.sq_wakeups << " SQ thread wakeups"
+            << std::endl;
+  peer.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+int main() {
+  {
+    io_context ctx;
+    ctx.schedule(echo(&ctx, "plain"));
+    ctx.run();
+  }
+  {
+    // the SQ thread on the last cpu, away from the loop (if there is more than one).
+    auto cpus = static_cast<int>(std::thread::hardware_concurrency());
+    auto ctx = io_context::with_sqpoll(64, cpus > 1 ? cpus - 1 : -1);
+    ctx.schedule(echo(&ctx, "sqpoll"));
+    ctx.run();
+  }
+}
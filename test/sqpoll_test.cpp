@@ -0,0 +1,109 @@
+// sqpoll_test.cpp
+// Created by PanJunzhong on 2022/5/29.
+//
+#include "coring/tcp_connection.hpp"
+#include "coring/timeout.hpp"
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+using namespace std::chrono_literals;
+
+namespace {
+task<> echo(io_context *ctx, int messages) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::thread peer{[fd = fds[1], messages] {
+    char msg[64] = {'x'};
+    for (int i = 0; i < messages; i++) {
+      ::send(fd, msg, sizeof(msg), 0);
+      for (size_t got = 0; got < sizeof(msg);) {
+        got += ::recv(fd, msg, sizeof(msg) - got, 0);
+      }
+    }
+  }};
+  char buf[64];
+  for (int i = 0; i < messages; i++) {
+    for (size_t got = 0; got < sizeof(buf);) {
+      int n = co_await conn.recv_some(buf + got, sizeof(buf) - got);
+      EXPECT_GT(n, 0);
+      got += n;
+    }
+    int n = co_await conn.send_some(buf, sizeof(buf));
+    EXPECT_EQ(n, 64);
+  }
+  peer.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+/// every round has a posted task queued, a.k.a. nothing to wait for.
+task<> post_chain(io_context *ctx, int left) {
+  if (left == 0) {
+    ctx->stop();
+    co_return;
+  }
+  ctx->post(post_chain(ctx, left - 1));
+}
+
+/// the SQ thread idles out during the sleep, the recv after it has to wake it up.
+task<> recv_after_idle(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  EXPECT_EQ(::send(fds[1], "abc", 3, 0), 3);
+  co_await timeout(50ms);
+  char buf[8];
+  int n = co_await conn.recv_some(buf, sizeof(buf));
+  EXPECT_EQ(n, 3);
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(SqPoll, Params) {
+  auto p = io_context::sqpoll_params(0, 10);
+  EXPECT_EQ(p.flags, IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF);
+  EXPECT_EQ(p.sq_thread_cpu, 0);
+  EXPECT_EQ(p.sq_thread_idle, 10);
+  EXPECT_EQ(io_context::sqpoll_params().flags, IORING_SETUP_SQPOLL);
+}
+
+TEST(SqPoll, RoundsWithoutWaitSkipEnters) {
+  auto ctx = io_context::with_sqpoll(64, 0);
+  ASSERT_TRUE(ctx.sqpoll());
+  ctx.schedule(post_chain(&ctx, 1000));
+  ctx.run();
+  auto &st = ctx.submit_stats();
+  // the eventfd read goes by the tail bump, a round with queued tasks doesn't wait.
+  EXPECT_GE(st.enters_avoided, 900);
+  EXPECT_LT(st.enters, 100);
+}
+
+TEST(SqPoll, Echo) {
+  auto ctx = io_context::with_sqpoll(64, 0);
+  ctx.schedule(echo(&ctx, 2000));
+  ctx.run();
+  auto &st = ctx.submit_stats();
+  // only the waits are left to enter, none of them submits.
+  EXPECT_LE(st.enters, 2 * 2000 + 2);
+  EXPECT_GE(st.enters + st.enters_avoided, 2000);
+}
+
+TEST(SqPoll, WakesTheIdleThreadUp) {
+  auto ctx = io_context::with_sqpoll(64, -1, 1);
+  ctx.schedule(recv_after_idle(&ctx));
+  ctx.run();
+  EXPECT_GT(ctx.submit_stats().sq_wakeups, 0);
+}
+
+TEST(SqPoll, EveryRoundEntersWithout) {
+  io_context ctx;
+  ASSERT_FALSE(ctx.sqpoll());
+  ctx.schedule(echo(&ctx, 100));
+  ctx.run();
+  EXPECT_EQ(ctx.submit_stats().enters_avoided, 0);
+  EXPECT_GE(ctx.submit_stats().enters, 2 * 100);
+}
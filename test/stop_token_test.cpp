@@ -0,0 +1,134 @@
+// stop_token_test.cpp
+// Created by PanJunzhong on 2022/5/29.
+//
+#include "coring/acceptor.hpp"
+#include "coring/tcp_connection.hpp"
+#include "coring/timeout.hpp"
+#include <chrono>
+#include <stop_token>
+#include <thread>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+using namespace coring;
+using namespace std::chrono_literals;
+
+namespace {
+task<> recv_stopped_here(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::stop_source src;
+  [](std::stop_source *src) -> async_run {
+    co_await timeout(10ms);
+    src->request_stop();
+  }(&src);
+  char buf[16];
+  int n = co_await conn.recv_some(buf, sizeof(buf), src.get_token());
+  EXPECT_EQ(n, -ECANCELED);
+  // it's stopped already, cancelled at once.
+  n = co_await conn.recv_some(buf, sizeof(buf), src.get_token());
+  EXPECT_EQ(n, -ECANCELED);
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> recv_stopped_elsewhere(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::stop_source src;
+  std::thread t{[&src] {
+    std::this_thread::sleep_for(10ms);
+    src.request_stop();
+  }};
+  char buf[16];
+  int n = co_await conn.recv_some(buf, sizeof(buf), src.get_token());
+  EXPECT_EQ(n, -ECANCELED);
+  t.join();
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> done_before_stop(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  std::stop_source src;
+  EXPECT_EQ(::send(fds[1], "abc", 3, 0), 3);
+  char buf[16];
+  int n = co_await conn.recv_some(buf, sizeof(buf), src.get_token());
+  EXPECT_EQ(n, 3);
+  // the callback is gone with the awaiter.
+  src.request_stop();
+  n = co_await conn.send_some(buf, 3, std::stop_token{});
+  EXPECT_EQ(n, 3);
+  ::close(fds[1]);
+  ctx->stop();
+}
+
+task<> accept_stopped_elsewhere(io_context *ctx) {
+  tcp::acceptor acceptor{"127.0.0.1", 0};
+  acceptor.enable();
+  std::stop_source src;
+  std::thread t{[&src] {
+    std::this_thread::sleep_for(10ms);
+    src.request_stop();
+  }};
+  try {
+    co_await acceptor.accept(src.get_token());
+    ADD_FAILURE() << "accepted a connection";
+  } catch (const std::system_error &e) {
+    EXPECT_EQ(e.code().value(), ECANCELED);
+  }
+  t.join();
+  ctx->stop();
+}
+
+task<> cancel_pending_recv(io_context *ctx) {
+  int fds[2];
+  EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  tcp::connection conn{fds[0]};
+  int n = 0;
+  [](tcp::connection *conn, int *n) -> async_run {
+    char buf[16];
+    *n = co_await conn->recv_some(buf, sizeof(buf));
+  }(&conn, &n);
+  int cancelled = co_await conn.cancel_pending();
+  EXPECT_EQ(cancelled, 1);
+  // the cqe of the recv may come after the one of the cancel.
+  co_await timeout(1ms);
+  EXPECT_EQ(n, -ECANCELED);
+  ::close(fds[1]);
+  ctx->stop();
+}
+}  // namespace
+
+TEST(StopToken, RecvStoppedOnTheLoop) {
+  io_context ctx;
+  ctx.schedule(recv_stopped_here(&ctx));
+  ctx.run();
+}
+
+TEST(StopToken, RecvStoppedOnAnotherThread) {
+  io_context ctx;
+  ctx.schedule(recv_stopped_elsewhere(&ctx));
+  ctx.run();
+}
+
+TEST(StopToken, DoneBeforeStop) {
+  io_context ctx;
+  ctx.schedule(done_before_stop(&ctx));
+  ctx.run();
+}
+
+TEST(StopToken, AcceptStoppedOnAnotherThread) {
+  io_context ctx;
+  ctx.schedule(accept_stopped_elsewhere(&ctx));
+  ctx.run();
+}
+
+TEST(StopToken, CancelPendingByFd) {
+  io_context ctx;
+  ctx.schedule(cancel_pending_recv(&ctx));
+  ctx.run();
+}
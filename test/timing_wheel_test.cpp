@@ -0,0 +1,123 @@
+
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "coring/detail/timing_wheel.hpp"
+using wheel_t = coring::detail::timing_wheel<int, long>;
+
+TEST(TimingWheel, PopInOrderOfTicks) {
+  wheel_t w{};
+  w.emplace(5, 5);
+  w.emplace(1, 1);
+  w.emplace(64, 64);
+  w.emplace(4096 + 3, 4099);
+  EXPECT_EQ(w.size(), 4);
+  EXPECT_EQ(w.pop_less_eq(0).size(), 0);
+  EXPECT_EQ(w.pop_less_eq(1), std::vector<int>{1});
+  EXPECT_EQ(w.pop_less_eq(63), std::vector<int>{5});
+  EXPECT_EQ(w.pop_less_eq(64), std::vector<int>{64});
+  EXPECT_EQ(w.pop_less_eq(4098).size(), 0);
+  EXPECT_EQ(w.pop_less_eq(1'000'000), std::vector<int>{4099});
+  EXPECT_TRUE(w.empty());
+}
+
+TEST(TimingWheel, NextExpirationNeverLate) {
+  wheel_t w{1000};
+  w.emplace(1000 + 70000, 1);
+  auto exp = w.next_expiration();
+  EXPECT_LE(exp, 1000 + 70000);
+  EXPECT_GT(exp, 1000);
+  // walk by next_expiration like timer does.
+  int rounds = 0;
+  while (!w.empty()) {
+    exp = w.next_expiration();
+    w.pop_less_eq(exp);
+    ASSERT_LT(++rounds, 16);
+  }
+  EXPECT_EQ(exp, 1000 + 70000);
+  // expired ones
+  w.emplace(10, 2);
+  EXPECT_EQ(w.next_expiration(), w.current_time());
+  EXPECT_EQ(w.pop_less_eq(w.current_time()), std::vector<int>{2});
+}
+
+TEST(TimingWheel, EraseByHandle) {
+  wheel_t w{};
+  auto a = w.emplace(100, 1);
+  auto b = w.emplace(100, 2);
+  w.emplace(100, 3);
+  w.erase(b);
+  w.erase(a);
+  EXPECT_EQ(w.size(), 1);
+  EXPECT_EQ(w.pop_less_eq(100), std::vector<int>{3});
+  // erase the last of a slot clears it, the next expiration would not stop there.
+  auto c = w.emplace(200, 4);
+  w.emplace(300, 5);
+  w.erase(c);
+  EXPECT_GT(w.next_expiration(), 200);
+}
+
+TEST(TimingWheel, EraseInsideCallback) {
+  wheel_t w{};
+  auto later = w.emplace(50, 2);
+  w.emplace(10, 1);
+  int called = 0;
+  w.do_less_eq_then_pop(20, [&](int &v) {
+    EXPECT_EQ(v, 1);
+    called++;
+    w.erase(later);
+    w.emplace(5, 3);  // already expired, handled next time
+  });
+  EXPECT_EQ(called, 1);
+  EXPECT_EQ(w.size(), 1);
+  EXPECT_EQ(w.pop_less_eq(20), std::vector<int>{3});
+}
+
+TEST(TimingWheel, RandomAgainstMultimap) {
+  std::mt19937_64 rng{42};
+  wheel_t w{};
+  std::multimap<long, int> ref{};
+  std::map<int, wheel_t::handle_t> handles{};
+  std::map<int, std::multimap<long, int>::iterator> ref_its{};
+  long now = 0;
+  int id = 0;
+  for (int round = 0; round < 20000; round++) {
+    auto op = rng() % 10;
+    if (op < 5) {
+      // spread over several wheels
+      long delay = static_cast<long>(rng() % (1ul << (rng() % 30)));
+      handles[id] = w.emplace(now + delay, id);
+      ref_its[id] = ref.emplace(now + delay, id);
+      id++;
+    } else if (op < 7 && !handles.empty()) {
+      auto it = handles.lower_bound(static_cast<int>(rng() % id));
+      if (it == handles.end()) {
+        it = handles.begin();
+      }
+      w.erase(it->second);
+      ref.erase(ref_its[it->first]);
+      ref_its.erase(it->first);
+      handles.erase(it);
+    } else {
+      now += static_cast<long>(rng() % (1ul << (rng() % 20)));
+      std::vector<int> expect{};
+      auto last = ref.upper_bound(now);
+      for (auto it = ref.begin(); it != last; it++) {
+        expect.push_back(it->second);
+        handles.erase(it->second);
+        ref_its.erase(it->second);
+      }
+      ref.erase(ref.begin(), last);
+      auto got = w.pop_less_eq(now);
+      std::sort(expect.begin(), expect.end());
+      std::sort(got.begin(), got.end());
+      ASSERT_EQ(got, expect);
+      if (!ref.empty()) {
+        ASSERT_LE(w.next_expiration(), ref.begin()->first);
+      }
+    }
+    ASSERT_EQ(w.size(), ref.size());
+  }
+}